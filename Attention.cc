@@ -0,0 +1,155 @@
+#include <cmath>
+#include <array>
+#include <vector>
+#include <limits>
+#include <utility>
+#include <algorithm>
+#include <stdexcept>
+
+#include "Types.hh"
+#include "include/Declare_functions.hh"
+
+using namespace std;
+
+
+namespace {
+
+// Number of keys (and values) processed at a time for each query
+constexpr size_t ATTENTION_TILE = 64;
+
+}  // namespace
+
+
+
+/* ==========================================================================
+ * Routine returning the ranges [begin, end) of the keys that query m
+ * attends to: [0, m+1) for full causal attention (window==0), the first
+ * 'nglobal' tokens and the last 'window' ones otherwise (the second range
+ * being empty if they overlap)
+ * ========================================================================== */
+array<pair<size_t, size_t>, 2> attended_keys(const size_t &m,
+                                             const size_t &window,
+                                             const size_t &nglobal) {
+    if (window == 0 or window > m) {
+        return {{{0, m+1}, {m+1, m+1}}};
+    }
+
+    const auto global_end  = min(nglobal, m+1);
+    const auto local_begin = max(global_end, m+1 - window);
+
+    return {{{0, global_end}, {local_begin, m+1}}};
+}
+
+
+
+/* =============================================================================
+ * Routine computing causal (masked) attention: each row m of the output is the
+ * average of the value vectors n <= m weighted by the softmax of the scores
+ *   scale*<query m, key n>
+ * With window > 0 (local attention), row m only attends to the last 'window'
+ * tokens, m-window+1..m, plus the first 'nglobal' tokens, which every row can
+ * attend to (if they precede it), making the cost O(nrows*(window + nglobal))
+ * instead of O(nrows^2). window==0 means full causal attention.
+ * The softmax is computed online: keys and values go through in tiles of
+ * ATTENTION_TILE and the running maximum score and sum of exponentials are
+ * updated after each tile, rescaling the partial output row accordingly. This
+ * way the scores are only ever stored for one tile (on the stack) and each
+ * output row is built in a single pass over the keys and values.
+ * Optionally, the log-sum-exp of the scores of each row (the only quantity
+ * needed to recompute the attention weights in a backward pass, together with
+ * attended_keys()) is stored in 'lse'.
+ * ============================================================================= */
+void causal_attention(const tensor_view_t<const double> &queries,
+                      const tensor_view_t<const double> &keys,
+                      const tensor_view_t<const double> &values,
+                      const tensor_view_t<double>       &contexts,
+                      const double                      &scale,
+                      const size_t                      &window,
+                      const size_t                      &nglobal,
+                      const tensor_view_t<double>       *lse) {
+    const auto nrows = queries.rows();
+    const auto dim   = queries.cols();
+    const auto ncols = values.cols();
+
+    if (keys.rows() != nrows or keys.cols() != dim or values.rows() != nrows or
+        contexts.rows() != nrows or contexts.cols() != ncols) {
+        throw runtime_error("causal_attention(): the keys must be shaped like the queries, and the values like the contexts, with as many rows as the queries");
+        return;  // Not reached
+    }
+
+    if (lse != nullptr and lse->size() != nrows) {
+        throw runtime_error("causal_attention(): lse->size() must equal the number of queries");
+        return;  // Not reached
+    }
+
+    array<double, ATTENTION_TILE> scores;
+
+    for (auto m = decltype(nrows){0}; m < nrows; ++m) {
+        const auto *query_m   = queries.row(m);
+        auto       *context_m = contexts.row(m);
+
+        auto   max_score = -numeric_limits<double>::infinity();
+        double sum_exp   = 0.;
+
+        fill(context_m, context_m + ncols, 0.);
+
+        const auto keys_m = attended_keys(m, window, nglobal);
+
+        for (const auto &[n_begin, n_end] : keys_m) {
+            for (auto n0 = n_begin; n0 < n_end; n0 += ATTENTION_TILE) {
+                const auto ntile = min(ATTENTION_TILE, n_end - n0);
+
+                // Scores of this tile and their maximum
+                auto max_tile = -numeric_limits<double>::infinity();
+
+                for (auto n = decltype(ntile){0}; n < ntile; ++n) {
+                    const auto *key_n = keys.row(n0 + n);
+                    double      score = 0.;
+
+                    for (auto l = decltype(dim){0}; l < dim; ++l) {
+                        score += query_m[l]*key_n[l];
+                    }
+
+                    scores[n] = score*scale;
+                    max_tile  = max(max_tile, scores[n]);
+                }
+
+                /* Rescale the sum of exponentials and the partial context
+                 * vector if the running maximum has changed                    */
+                if (max_tile > max_score) {
+                    const auto correction = exp(max_score - max_tile);  // 0 for the first tile
+                    sum_exp *= correction;
+
+                    for (auto i = decltype(ncols){0}; i < ncols; ++i) {
+                        context_m[i] *= correction;
+                    }
+
+                    max_score = max_tile;
+                }
+
+                // Accumulate the (unnormalized) weighted values of this tile
+                for (auto n = decltype(ntile){0}; n < ntile; ++n) {
+                    const auto  weight   = exp(scores[n] - max_score);
+                    const auto *values_n = values.row(n0 + n);
+                    sum_exp += weight;
+
+                    for (auto i = decltype(ncols){0}; i < ncols; ++i) {
+                        context_m[i] += weight*values_n[i];
+                    }
+                }
+            }
+        }
+
+        const auto sum_exp_inv = 1./sum_exp;
+
+        for (auto i = decltype(ncols){0}; i < ncols; ++i) {
+            context_m[i] *= sum_exp_inv;
+        }
+
+        if (lse != nullptr) {
+            (*lse)[m] = max_score + log(sum_exp);
+        }
+    }
+
+    return;
+}
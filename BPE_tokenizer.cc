@@ -1,14 +1,24 @@
 #include <cassert>
+#include <cstdint>
+#include <array>
 #include <iostream>
 #include <vector>
 #include <string>
 #include <sstream>
 #include <utility>
 #include <unordered_map>
-#include <regex>
+#include <unordered_set>
 #include <algorithm>
+#include <queue>
+#include <functional>
+#include <limits>
+#include <string_view>
+#include <memory>
+#include <istream>
+#include <ostream>
 
 #include "Types.hh"
+#include "include/Declare_functions.hh"
 #include "Parameters.hh"
 
 using namespace std;
@@ -19,61 +29,74 @@ using namespace std;
  * ================================================================= */
 bpe_tokenizer_t::bpe_tokenizer_t(const string &training_text,
                                  const string &eow,
-                                 const size_t &max_vocab_size) {
-    /* -------------------------------------------------------------------
-     * 1. Build a list of all the words in the training text as vectors of
-     *    individual characters
-     * -------------------------------------------------------------------      */
-    /* This regex matches words, numbers, and punctuation as individual tokens,
-     * which should be regarded as lists of "symbols"                           */
-    regex                 word_re(R"([a-zA-Z0-9]+|[.,;:!?'"()\[\]\{\}\/\\])");
-    sregex_token_iterator words_it(training_text.begin(), training_text.end(), word_re);
-    sregex_token_iterator end;
-
-    vector<vector<string>> words_list;
-
-    while (words_it != end) {
-        /* Make all words lowercase to avoid duplicating them if they occur
-         * multiple times with different cases                                  */
-        auto word = words_it->str();
-        transform(word.begin(), word.end(), word.begin(), //std::tolower);
-                  /* Wrap ::tolower in a lambda to cast the input into
-                   * unsigned char to avoid undefined behavior if the input
-                   * char is signed and negative (non-ASCII byte)           */
-                  [](unsigned char c)->char {
-                      return static_cast<char>(std::tolower(c));
-                  }
-                 );
-
-        /* Convert the word into a vector of strings (for now just individual
-         * characters, then these will be iteratively replaced with strings of
-         * multiple characters)                                                 */
-        const auto word_size = word.size();
-        vector<string> word_strvec(word_size);
-
-        for (auto i = decltype(word_size){0}; i < word_size; ++i) {
-            word_strvec.at(i) = word.at(i);
+                                 const size_t &max_vocab_size,
+                                 const size_t &nthreads) {
+    /* ---------------------------------------------------------------------
+     * 1. Build a table of all the unique words in the training text and of
+     *    the number of times each of them occurs in the text, so that the
+     *    symbol pair counts below can be weighted by the word frequencies
+     *    without storing repeated words
+     * ---------------------------------------------------------------------    */
+    /* Split the text into words, numbers, and punctuation characters (all of
+     * them lowercase), which should be regarded as lists of "symbols"          */
+    pretokenizer_t pretokenizer(training_text);
+
+    /* NOTE: words are stored in order of first occurrence in the text, so that
+     *       the IDs of the initial (single-character) symbols below don't
+     *       depend on the hash map's iteration order                           */
+    unordered_map<string, size_t> word2idx;
+    vector<string> words_list;
+    vector<size_t> words_freq;
+
+    /* NOTE: reusing the same string to look words up in the word table to
+     *       avoid allocating memory for each word                              */
+    string word;
+
+    while (pretokenizer.next()) {
+        word.assign(pretokenizer.word());
+
+        /* Insert the word into the word table if not there yet, otherwise just
+         * increase its frequency                                               */
+        const auto it_word = word2idx.find(word);
+
+        if (it_word == word2idx.end()) {
+            word2idx.emplace(word, words_list.size());
+            words_list.emplace_back(word);
+            words_freq.emplace_back(1);
+        } else {
+            ++words_freq.at(it_word->second);
         }
+    }
 
-        // Append the end-of-word character to the last character in the word
-        word_strvec.at(word_size - 1) += eow;
-
-        // Insert the word into the word list if not there yet
-        if (find(words_list.begin(), words_list.end(), word_strvec) == words_list.end()) {
-            words_list.emplace_back(word_strvec);
-        }
+    const auto nwords = words_list.size();
 
-        ++words_it;
+    if (nwords < 1) {
+        throw runtime_error("bpe_tokenizer_t(): need at least one word in the text");
     }
 
 
-    /* --------------------------------------------------------------
-     * 2. Add each individual character to the token-to-ID vocabulary
-     * -------------------------------------------------------------- */
-    size_t id = 0;
+    /* ---------------------------------------------------------------------
+     * 2. Add each individual character to the token-to-ID vocabulary, with
+     *    the end-of-word character appended to the last character of each
+     *    word. Meanwhile, convert each word into a list of symbol IDs
+     *    (initially one ID per character, then characters will be iteratively
+     *    merged into subwords).
+     * ---------------------------------------------------------------------    */
+    vector<vector<size_t>> words_ids(nwords);
+
+    for (auto w = decltype(nwords){0}; w < nwords; ++w) {
+        const auto &word      = words_list.at(w);
+        const auto  word_size = word.size();
+        auto       &word_ids  = words_ids.at(w);
+        word_ids.reserve(word_size);
+
+        for (auto i = decltype(word_size){0}; i < word_size; ++i) {
+            string token(1, word.at(i));
+
+            if (i == word_size - 1) {
+                token += eow;
+            }
 
-    for (const auto &word_strvec : words_list) {
-        for (const auto &token : word_strvec) {
             // Sanity check
             if (token == eow) {
                 throw runtime_error("bpe_tokenizer_t(): found end-of-word character token in the training text. This is not supported: please change the end-of-word character to something not present in the training text.");
@@ -83,112 +106,256 @@ bpe_tokenizer_t::bpe_tokenizer_t(const string &training_text,
              * token lookup in bpe_tokenizer_t::encode()); this will only
              * succeed if the token is not in the vocabulary yet, since the
              * tokens are the keys in the map and keys are unique               */
-            if ((this->vocab_token2id).emplace(token, id).second) {
-                ++id;
-            } else {
+            const auto [token_id, inserted] = (this->vocab).insert(token);
+
+            if (not inserted) {
                 #if (VERBOSE)
                 cout << "Skipping repeated token '" << token
                      << "' while creating the token-to-ID vocabulary" << endl;
                 #endif
             }
+
+            word_ids.emplace_back(token_id);
         }
     }
 
-    if ((this->vocab_token2id).size() > max_vocab_size) {
+    if ((this->vocab).size() > max_vocab_size) {
         ostringstream error_ss;
-        error_ss << "bpe_tokenizer_t(): initial vocabulary size (" << (this->vocab_token2id).size()
+        error_ss << "bpe_tokenizer_t(): initial vocabulary size (" << (this->vocab).size()
                  << ") larger than maximum allowed vocabulary size (" << max_vocab_size
                  << "). Please increase the maximum allowed vocabulary size to at least "
-                 << (this->vocab_token2id).size() << ".";
+                 << (this->vocab).size() << ".";
         throw runtime_error(error_ss.str());
     }
 
 
     /* ----------------------------------------------------------------------
-     * 3. For each word in the training text, loop over all symbol pairs
-     *    (initially symbol=character, then characters will be iteratively
-     *    merged into subwords) in the word and build a temporary map of
-     *    symbol-pairs->frequency. Then, find the symbol pair that occurs the
-     *    most, replace its separate symbols in the words list with that
-     *    symbol pair (a single string), and add the merged pair to the
-     *    token-to-ID vocabulary. Repeat until the token-to-ID vocabulary
-     *    reaches the maximum, user-specified, size.
+     * 3. Count the occurrences of every pair of adjacent symbols across all
+     *    words, weighted by the word frequencies, and keep track of which
+     *    words each symbol pair occurs in. Then, repeatedly pick the most
+     *    common symbol pair, merge it into a single symbol, and add the
+     *    merged pair to the token-to-ID vocabulary until the vocabulary
+     *    reaches the maximum, user-specified, size. After each merge, only
+     *    the words containing the merged pair are visited and only their
+     *    contribution to the pair counts is updated, so that the cost of a
+     *    merge scales with the number of occurrences of the merged pair
+     *    rather than with the size of the training text.
      * ----------------------------------------------------------------------   */
-    const auto nwords = words_list.size();
+    /* NOTE: the symbol-pair tables are split into one shard per thread, each
+     *       shard holding the symbol pairs whose hash modulo the number of
+     *       shards equals the shard index. Words are first processed in
+     *       parallel, each thread collecting the pair-count updates for its
+     *       own chunk of words into thread-local lists (one per shard); then
+     *       the shards are updated in parallel, each by a single thread,
+     *       applying the updates from all threads in order of thread ID. Since
+     *       the counts are sums, the resulting vocabulary doesn't depend on the
+     *       number of threads.                                                 */
+    thread_pool_t pool(nthreads);
+    const auto    nshards = pool.size();
+
+    struct symbolpairs_shard_t {
+        unordered_map<symbolpair_t, size_t,                symbolpair_hash_t> freq;
+        unordered_map<symbolpair_t, unordered_set<size_t>, symbolpair_hash_t> words;
+        unordered_set<symbolpair_t, symbolpair_hash_t> touched;  // Pairs whose frequency changed during the current merge
+    };
+
+    // Change in the frequency of a symbol pair due to word 'w'
+    struct symbolpair_update_t {
+        symbolpair_t symbol_pair;
+        size_t       w;
+        size_t       freq;
+        bool         added;  // Whether the pair has been added to or removed from the word
+    };
+
+    vector<symbolpairs_shard_t> shards(nshards);
+    vector<vector<vector<symbolpair_update_t>>> updates(nshards, vector<vector<symbolpair_update_t>>(nshards));  // [thread][shard]
+
+    const auto shard_index = [nshards](const symbolpair_t &symbol_pair) {
+        return symbolpair_hash_t{}(symbol_pair) % nshards;
+    };
+
+    const auto find_freq = [&](const symbolpair_t &symbol_pair) -> const size_t* {
+        const auto &freq    = shards.at(shard_index(symbol_pair)).freq;
+        const auto  it_freq = freq.find(symbol_pair);
+        return (it_freq == freq.end()) ? nullptr : &(it_freq->second);
+    };
+
+    // Apply the updates collected by all threads to each shard
+    const auto apply_updates = [&]() {
+        pool.parallel_for(nshards, [&](const size_t &shard_begin, const size_t &shard_end, const size_t&) {
+            for (auto sh = shard_begin; sh < shard_end; ++sh) {
+                auto &shard = shards.at(sh);
+
+                for (auto &thread_updates : updates) {
+                    for (const auto &[symbol_pair, w, freq, added] : thread_updates.at(sh)) {
+                        if (added) {
+                            shard.freq[symbol_pair] += freq;
+                            shard.words[symbol_pair].emplace(w);
+                        } else {
+                            auto it_freq = shard.freq.find(symbol_pair);
+                            assert(it_freq != shard.freq.end() and it_freq->second >= freq);
+
+                            if ((it_freq->second -= freq) == 0) {
+                                shard.freq.erase(it_freq);
+                            }
+                        }
+
+                        shard.touched.emplace(symbol_pair);
+                    }
 
-    if (nwords < 1) {
-        throw runtime_error("bpe_tokenizer_t(): need at least one word in the text");
-    }
+                    thread_updates.at(sh).clear();
+                }
+            }
+        });
+    };
 
-    while ((this->vocab_token2id).size() < max_vocab_size) {
-        unordered_map<string, size_t> symbolpairs_freq;
-
-        for (const auto &word_strvec : words_list) {
-            for (auto i = decltype(word_strvec.size()){0}; i < word_strvec.size()-1; ++i) {
-                const string symbol_pair = word_strvec.at(i) + word_strvec.at(i+1);
-
-                /* Try adding 'symbol_pair' to 'symbolpairs_freq' with an
-                 * initial frequency of 1; if that fails, that means the symbol
-                 * pair is already in the map, so increment its frequency by 1. */
-                if (not symbolpairs_freq.emplace(symbol_pair, 1).second) {
-                    try {
-                        symbolpairs_freq.at(symbol_pair) += 1;
-                    } catch (const exception &e) {
-                        ostringstream exception_ss;
-                        exception_ss << "bpe_tokenizer_t(): failed to access the symbol-pair->frequency map at key '" << symbol_pair <<
-                            "'. This key should exist, please check the code (exception: \"" << e.what() << "\").";
-                        throw runtime_error(exception_ss.str());
-                    }
+    pool.parallel_for(nwords, [&](const size_t &w_begin, const size_t &w_end, const size_t &thread_id) {
+        auto &thread_updates = updates.at(thread_id);
+
+        for (auto w = w_begin; w < w_end; ++w) {
+            const auto &word_ids = words_ids.at(w);
+
+            for (auto i = decltype(word_ids.size()){1}; i < word_ids.size(); ++i) {
+                const symbolpair_t symbol_pair(word_ids.at(i-1), word_ids.at(i));
+                thread_updates.at(shard_index(symbol_pair)).push_back({symbol_pair, w, words_freq.at(w), true});
+            }
+        }
+    });
+
+    apply_updates();
+
+    /* Max-heap of (frequency, symbol pair) entries used to pick the next merge.
+     * Entries are never updated in place: every time the frequency of a symbol
+     * pair changes, a new entry is pushed, and entries whose frequency no
+     * longer matches the one in the symbol-pair tables are discarded when
+     * popped.
+     * NOTE: ties are broken in favor of the pair with the lowest symbol IDs
+     *       (i.e., made of the symbols added to the vocabulary first), so that
+     *       the resulting vocabulary is deterministic                          */
+    using heap_entry_t = pair<size_t, symbolpair_t>;
+    const auto heap_cmp = [](const heap_entry_t &a, const heap_entry_t &b) {
+        return (a.first < b.first) or (a.first == b.first and a.second > b.second);
+    };
+    priority_queue<heap_entry_t, vector<heap_entry_t>, decltype(heap_cmp)> symbolpairs_heap(heap_cmp);
+
+    // Push the pairs whose frequency changed onto the heap
+    const auto push_touched = [&]() {
+        for (auto &shard : shards) {
+            for (const auto &symbol_pair : shard.touched) {
+                const auto it_freq = shard.freq.find(symbol_pair);
+                if (it_freq != shard.freq.end()) {
+                    symbolpairs_heap.emplace(it_freq->second, symbol_pair);
                 }
             }
+
+            shard.touched.clear();
         }
+    };
+
+    push_touched();
 
-        const auto iterator_maxcounts = max_element(symbolpairs_freq.begin(), symbolpairs_freq.end(),
-                                                    [](const auto &a, const auto &b){
-                                                        return (a.second < b.second);
-                                                    });
-        const auto &most_common_symbolpair      = iterator_maxcounts->first;
-        const auto &most_common_symbolpair_freq = iterator_maxcounts->second;
+    vector<size_t> words_to_update;
 
-        assert(most_common_symbolpair_freq > 0);
+    while ((this->vocab).size() < max_vocab_size) {
+        // Discard stale heap entries
+        while (not symbolpairs_heap.empty()) {
+            const auto &[freq, symbol_pair] = symbolpairs_heap.top();
+            const auto  current_freq        = find_freq(symbol_pair);
 
-        if (most_common_symbolpair_freq == 1) {
+            if (current_freq != nullptr and *current_freq == freq) {
+                break;
+            }
+
+            symbolpairs_heap.pop();
+        }
+
+        if (symbolpairs_heap.empty() or symbolpairs_heap.top().first == 1) {
             cerr << "********** WARNING **********" << endl
-                 << "Merging symbols stopped at vocabulary size " << (this->vocab_token2id).size()
+                 << "Merging symbols stopped at vocabulary size " << (this->vocab).size()
                  << " (maximum allowed vocabulary size: " << max_vocab_size
                  << ") because no other merges are possible" << endl
                  << "*****************************" << endl;
             break;
-        } else {
-            // Update the words list for the next iteration
-            for (auto &word_strvec : words_list) {
-                for (auto i = decltype(word_strvec.size()){0}; i < word_strvec.size()-1; ++i) {
-                    const string symbol_pair = word_strvec.at(i) + word_strvec.at(i+1);
-                    if (symbol_pair == most_common_symbolpair) {
-                        word_strvec.at(i)   = most_common_symbolpair;
-                        word_strvec.at(i+1) = "";
-                    }
-                }
-
-                /* Delete empty strings (empty because they have been merged above)
-                 * from the "word" (list of symbols)                                */
-                for (auto i = decltype(word_strvec.size()){0}; i < word_strvec.size(); ++i) {
-                    if (word_strvec.at(i) == "") {
-                        word_strvec.erase(word_strvec.begin() + i);
-                    }
-                }
-            }
         }
 
-        // Add the most common symbol pair to the token-to-ID vocabulary
-        if ((this->vocab_token2id).emplace(most_common_symbolpair, id).second) {
-            ++id;
-        } else {
+        const auto most_common_symbolpair = symbolpairs_heap.top().second;
+        symbolpairs_heap.pop();
+
+        const auto &[id_left, id_right] = most_common_symbolpair;
+
+        string merged_symbol((this->vocab).token(id_left));
+        merged_symbol += (this->vocab).token(id_right);
+
+        /* Add the most common symbol pair to the token-to-ID vocabulary. If the
+         * merged symbol is already there (i.e., it has been obtained by
+         * merging a different pair of symbols before), reuse its ID.           */
+        const auto [id_merged, inserted] = (this->vocab).insert(merged_symbol);
+
+        if (not inserted) {
             #if (VERBOSE)
-            cout << "Skipping repeated token '" << most_common_symbolpair 
+            cout << "Skipping repeated token '" << merged_symbol
                  << "' while creating the token-to-ID vocabulary" << endl;
             #endif
         }
+
+        // Record the merge and its rank for bpe_tokenizer_t::encode()
+        const auto rank = (this->merges).size();
+
+        if (not (this->merges).emplace(most_common_symbolpair, make_pair(rank, id_merged)).second) {
+            throw runtime_error("bpe_tokenizer_t(): symbol pair merged twice. This should never happen, please check the code.");
+        }
+
+        /* Merge the pair in every word containing it, removing the old symbol
+         * pairs of the word from the pair counts and adding the new ones       */
+        auto &shard_merged = shards.at(shard_index(most_common_symbolpair));
+        auto  it_words     = shard_merged.words.find(most_common_symbolpair);
+        assert(it_words != shard_merged.words.end());
+
+        words_to_update.assign(it_words->second.begin(), it_words->second.end());
+        shard_merged.words.erase(it_words);
+
+        pool.parallel_for(words_to_update.size(), [&](const size_t &k_begin, const size_t &k_end, const size_t &thread_id) {
+            auto &thread_updates = updates.at(thread_id);
+
+            for (auto k = k_begin; k < k_end; ++k) {
+                const auto  w         = words_to_update.at(k);
+                auto       &word_ids  = words_ids.at(w);
+                const auto  word_size = word_ids.size();
+                const auto  word_freq = words_freq.at(w);
+
+                for (auto i = decltype(word_size){1}; i < word_size; ++i) {
+                    const symbolpair_t symbol_pair(word_ids.at(i-1), word_ids.at(i));
+                    thread_updates.at(shard_index(symbol_pair)).push_back({symbol_pair, w, word_freq, false});
+                }
+
+                // Replace all the (non-overlapping) occurrences of the pair
+                size_t i_new = 0;
+
+                for (auto i = decltype(word_size){0}; i < word_size; ++i, ++i_new) {
+                    if (i + 1 < word_size and word_ids.at(i) == id_left and word_ids.at(i+1) == id_right) {
+                        word_ids.at(i_new) = id_merged;
+                        ++i;
+                    } else {
+                        word_ids.at(i_new) = word_ids.at(i);
+                    }
+                }
+
+                word_ids.resize(i_new);
+
+                for (auto i = decltype(i_new){1}; i < i_new; ++i) {
+                    const symbolpair_t symbol_pair(word_ids.at(i-1), word_ids.at(i));
+                    thread_updates.at(shard_index(symbol_pair)).push_back({symbol_pair, w, word_freq, true});
+                }
+            }
+        });
+
+        apply_updates();
+
+        // The merged pair has disappeared from every word
+        assert(find_freq(most_common_symbolpair) == nullptr);
+        shard_merged.words.erase(most_common_symbolpair);
+
+        push_touched();
     }
 
 
@@ -197,34 +364,99 @@ bpe_tokenizer_t::bpe_tokenizer_t(const string &training_text,
      * ---------- */
     /* Add extra IDs to the token-to-ID vocabulary to handle unknown and
      * end-of-text (useful when training with multiple text sources) tokens     */
-    const auto original_vocab_size = (this->vocab_token2id).size();
+    const auto original_vocab_size = (this->vocab).size();
     (this->unk) = {"<|unknown|>",     original_vocab_size};
     (this->eot) = {"<|end-of-text|>", original_vocab_size + 1};
 
-    if (not (this->vocab_token2id).emplace(this->unk).second) {
+    if (not (this->vocab).insert((this->unk).first).second) {
         throw runtime_error("bpe_tokenizer_t(): insertion of 'unknown' token failed");
     }
 
-    if (not (this->vocab_token2id).emplace(this->eot).second) {
+    if (not (this->vocab).insert((this->eot).first).second) {
         throw runtime_error("bpe_tokenizer_t(): insertion of 'end-of-text' token failed");
     }
 
-    /* Build the ID-to-token vocabulary for fast (O(1)) ID lookup in
-     * bpe_tokenizer_t::decode()                                                */
-    (this->vocab_id2token).reserve((this->vocab_token2id).size());
+    // Initialize the internal end-of-word string for the encode() method
+    (this->eow) = eow;
 
-    for (const auto &[token, id] : (this->vocab_token2id)) {
-        if (not (this->vocab_id2token).emplace(id, token).second) {
-            ostringstream exception_ss;
-            exception_ss << "bpe_tokenizer_t(): unexpected repetition of element [" << id << ", " << token
-                         << "] in the ID-to-token vocabulary. This may happen if ID " << id
-                         << " is not unique in the token-to-ID vocabulary.";
-            throw runtime_error(exception_ss.str());
+    /* Build the character-to-ID tables used by bpe_tokenizer_t::encode() to
+     * map each character of a word into its initial symbol ID                  */
+    build_char_tables();
+}
+
+
+
+/* ==========================================================================
+ * Constructor loading the vocabulary and the merge list from a (validated)
+ * binary tokenizer file. The vocabulary points directly into the
+ * memory-mapped file, which is kept alive by the tokenizer.
+ * ========================================================================== */
+bpe_tokenizer_t::bpe_tokenizer_t(const shared_ptr<const tokenizer_file_t> &file)
+    : vocab(file->token_offsets(), file->token_blob(), file->vocab_size(), file) {
+    const auto nmerges = file->nmerges();
+
+    (this->merges).reserve(nmerges);
+
+    for (auto rank = decltype(nmerges){0}; rank < nmerges; ++rank) {
+        const auto m = file->merge(rank);
+
+        if (not (this->merges).emplace(symbolpair_t(m.at(0), m.at(1)), make_pair(rank, m.at(2))).second) {
+            throw runtime_error("bpe_tokenizer_t(): symbol pair merged twice in the tokenizer file");
         }
     }
 
-    // Initialize the internal end-of-word string for the encode() method
-    (this->eow) = eow;
+    (this->unk) = {string(file->token(file->unk_id())), file->unk_id()};
+    (this->eot) = {string(file->token(file->eot_id())), file->eot_id()};
+    (this->eow) = file->eow();
+
+    build_char_tables();
+}
+
+
+
+/* =========================================================================
+ * Method saving the vocabulary and the merge list to a binary tokenizer file
+ * ========================================================================= */
+void bpe_tokenizer_t::save(const string   &filename,
+                           const uint64_t &fingerprint) const {
+    // Merges in order of rank
+    vector<array<uint64_t, 3>> merges_list((this->merges).size());
+
+    for (const auto &[symbol_pair, rank_id] : (this->merges)) {
+        merges_list.at(rank_id.first) = {symbol_pair.first, symbol_pair.second, rank_id.second};
+    }
+
+    tokenizer_file_t::write(filename, BPE, fingerprint, (this->vocab), merges_list,
+                            (this->eow), (this->unk).second, (this->eot).second);
+    return;
+}
+
+
+
+/* ===========================================================================
+ * Method building the character-to-ID tables used by bpe_tokenizer_t::encode()
+ * to map each character of a word into its initial symbol ID
+ * =========================================================================== */
+void bpe_tokenizer_t::build_char_tables() {
+    (this->char2id).fill((this->unk).second);
+    (this->char_eow2id).fill((this->unk).second);
+
+    const auto &eow = (this->eow);
+
+    const auto nids = (this->vocab).size();
+
+    for (auto token_id = decltype(nids){0}; token_id < nids; ++token_id) {
+        const auto token = (this->vocab).token(token_id);
+        const auto c     = static_cast<unsigned char>(token.front());
+
+        if (token.size() == 1) {
+            (this->char2id).at(c) = token_id;
+        } else if (token.size() == 1 + eow.size() and token.substr(1) == eow) {
+            (this->char_eow2id).at(c) = token_id;
+        }
+    }
+
+    return;
 }
 
 
@@ -233,169 +465,272 @@ bpe_tokenizer_t::bpe_tokenizer_t(const string &training_text,
  * Encode method using the token-to-ID vocabulary to convert an input text into
  * the corresponding set of token IDs
  * ============================================================================ */
-vector<size_t> bpe_tokenizer_t::encode(const string &text) {
-    /* ---------------------------------------------------------------------
-     * 1. Build a list of all the words in the text as vectors of individual
-     *    characters
-     * ---------------------------------------------------------------------    */
-    /* This regex matches words, numbers, and punctuation as individual tokens,
-     * which should be regarded as lists of "symbols"                           */
-    regex                 word_re(R"([a-zA-Z0-9]+|[.,;:!?'"()\[\]\{\}\/\\])");
-    sregex_token_iterator words_it(text.begin(), text.end(), word_re);
-    sregex_token_iterator end;
-
-    vector<vector<string>> words_list;
-
-    while (words_it != end) {
-        /* Make all words lowercase to avoid duplicating them if they occur
-         * multiple times with different cases                                  */
-        auto word = words_it->str();
-        transform(word.begin(), word.end(), word.begin(), //std::tolower);
-                  /* Wrap ::tolower in a lambda to cast the input into
-                   * unsigned char to avoid undefined behavior if the input
-                   * char is signed and negative (non-ASCII byte)           */
-                  [](unsigned char c)->char {
-                      return static_cast<char>(std::tolower(c));
-                  }
-                 );
-
-        /* Convert the word into a vector of strings (for now just individual
-         * characters, then these will be iteratively replaced with strings of
-         * multiple characters)                                                 */
-        const auto word_size = word.size();
-        vector<string> word_strvec(word_size);
+vector<size_t> bpe_tokenizer_t::encode(const string &text) const {
+    vector<size_t> tokenIDs;
+    encode(text, tokenIDs);
 
-        for (auto i = decltype(word_size){0}; i < word_size; ++i) {
-            word_strvec.at(i) = word.at(i);
+    if (tokenIDs.empty()) {
+        throw runtime_error("bpe_tokenizer_t::encode(): need at least one word in the text");
+        return vector<size_t>();  // Not reached
+    }
+
+    return tokenIDs;
+}
+
+
+void bpe_tokenizer_t::encode(const string_view &text,
+                             vector<size_t>    &ids) const {
+    /* Split the text into words, numbers, and punctuation characters (all of
+     * them lowercase), which should be regarded as lists of "symbols"          */
+    pretokenizer_t   pretokenizer(text);
+    encode_scratch_t scratch;
+
+    if (not (this->cache)) {
+        while (pretokenizer.next()) {
+            encode_word(pretokenizer.word(), scratch, ids);
         }
 
-        // Append the end-of-word character to the last character in the word
-        word_strvec.at(word_size - 1) += (this->eow);
+        return;
+    }
+
+    /* Look each word up in the cache first, and only merge its symbols if not
+     * found there
+     * NOTE: reusing the same string to look words up in the cache to avoid
+     *       allocating memory for each word                                    */
+    string word;
 
-        /* Insert the word into the word list
-         * NOTE: insert repeated words as well, since we are encoding a text,
-         *       not building a vocabulary                                      */
-        words_list.emplace_back(word_strvec);
+    while (pretokenizer.next()) {
+        word.assign(pretokenizer.word());
 
-        ++words_it;
+        if (not (this->cache)->find(word, ids)) {
+            const auto nids_old = ids.size();
+            encode_word(word, scratch, ids);
+            (this->cache)->insert(word, ids.data() + nids_old, ids.data() + ids.size());
+        }
     }
 
+    return;
+}
 
-    /* -------------------------------------------------------------------------
-     * 2. For each word in the text, loop over all symbol pairs (initially
-     *    symbol=character, then characters will be iteratively merged into
-     *    subwords) in the word. For each word:
-     *      a. If at least one pair is part of the token-to-ID vocabulary, then
-     *         choose the pair with lowest ID (i.e., the pair that was added to
-     *         the token-to-ID vocabulary first) and replace the leftmost
-     *         occurrence of that pair in the word with the merged symbol.
-     *      b. Repeat step (a) until no pairs are found in the token-to-ID
-     *         vocabulary.
-     * -------------------------------------------------------------------------*/
-    const auto nwords = words_list.size();
-    
-    if (nwords < 1) {
+
+
+/* =========================================================
+ * Methods enabling the word->token IDs cache and reading
+ * the cache hit/miss counters
+ * ========================================================= */
+void bpe_tokenizer_t::enable_cache(const size_t &capacity) {
+    if (capacity > 0) {
+        (this->cache) = make_unique<encode_cache_t>(capacity);
+    } else {
+        (this->cache).reset();
+    }
+
+    return;
+}
+
+
+size_t bpe_tokenizer_t::cache_hits() const {
+    return (this->cache) ? (this->cache)->nhits() : 0;
+}
+
+
+size_t bpe_tokenizer_t::cache_misses() const {
+    return (this->cache) ? (this->cache)->nmisses() : 0;
+}
+
+
+
+/* =========================================================================
+ * Method encoding a text in parallel, splitting it into chunks at word
+ * boundaries
+ * ========================================================================= */
+vector<size_t> bpe_tokenizer_t::encode(const string  &text,
+                                       thread_pool_t &pool) const {
+    auto tokenIDs = encode_parallel(text, pool,
+        [this](const string_view &chunk, vector<size_t> &ids) { encode(chunk, ids); });
+
+    if (tokenIDs.empty()) {
         throw runtime_error("bpe_tokenizer_t::encode(): need at least one word in the text");
         return vector<size_t>();  // Not reached
     }
 
-    for (auto &word_strvec : words_list) {
-        bool symbol_merges_possible = true;
-
-        while (symbol_merges_possible) {
-            auto   i_symbolpair_replace = word_strvec.size();  // Invalid (too large) index within the word
-            string   symbolpair_replace = "";
-
-            for (auto i = decltype(word_strvec.size()){0}; i < word_strvec.size() - 1; ++i) {
-                const string symbol_pair = word_strvec.at(i) + word_strvec.at(i+1);
-                try {
-                    const auto id_symbol_pair = (this->vocab_token2id).at(symbol_pair);  // Throws an exception if 'symbol_pair' is not found in the token-to-ID vocabulary
-                    i_symbolpair_replace = i;
-                      symbolpair_replace = symbol_pair;
-                } catch (const exception &e) {
-                    #if (VERBOSE)
-                    cout << "Skipping unknown symbol pair '" << symbol_pair
-                         << "' while encoding the text (exception: \"" << e.what() << "\")" << endl;
-                    #endif
-                }
-            }
-    
-            if (i_symbolpair_replace < word_strvec.size()) {
-                assert(i_symbolpair_replace < word_strvec.size() - 1);  // Actually
-                word_strvec.at(i_symbolpair_replace) = symbolpair_replace;
-                word_strvec.erase(word_strvec.begin() + i_symbolpair_replace + 1);
-            } else {
-                symbol_merges_possible = false;
-                #if (VERBOSE)
-                cout << "No tokens found for this word in the token-to-ID vocabulary (this may just mean all tokens from the vocabulary have been merged into compound tokens)" << endl;
-                #endif
-            }
+    return tokenIDs;
+}
+
+
+
+/* ==============================================================================
+ * Methods encoding a whole stream or text chunk by chunk into a token-ID shard
+ * file
+ * ============================================================================== */
+size_t bpe_tokenizer_t::encode_to_shard(istream      &in,
+                                        const string &filename,
+                                        const size_t &chunk_size) const {
+    return ::encode_to_shard(in, filename, (this->vocab).size(), chunk_size,
+                             [this](const string_view &text, vector<size_t> &ids) { encode(text, ids); });
+}
+
+
+size_t bpe_tokenizer_t::encode_to_shard(const string_view &text,
+                                        const string      &filename,
+                                        const size_t      &chunk_size) const {
+    return ::encode_to_shard(text, filename, (this->vocab).size(), chunk_size,
+                             [this](const string_view &text, vector<size_t> &ids) { encode(text, ids); });
+}
+
+
+
+/* =============================================================================
+ * Method encoding a single word. The word is first split into its initial
+ * (single-character) symbols, which are kept in a doubly-linked list over the
+ * character positions. Then, the merges learned during training are replayed
+ * in order of rank: a min-heap of (rank, position) entries, one per adjacent
+ * symbol pair found in the merge-rank table, yields the leftmost occurrence of
+ * the lowest-rank pair, which is merged in place; the pairs formed with the
+ * neighboring symbols are then pushed onto the heap. Stale heap entries (i.e.,
+ * entries whose pair has been modified by a previous merge) are discarded when
+ * popped.
+ * NOTE: pairs formed after a merge whose rank is lower than that of the merge
+ *       are never pushed, since during training they would have been formed
+ *       after their own merge took place. This makes the encoding of each word
+ *       identical to the segmentation obtained at the end of training.
+ * ============================================================================= */
+void bpe_tokenizer_t::encode_word(const string_view &word,
+                                  encode_scratch_t  &scratch,
+                                  vector<size_t>    &ids) const {
+    const auto word_size = word.size();
+    assert(word_size > 0);
+
+    constexpr auto none = numeric_limits<size_t>::max();
+
+    auto &symbols = scratch.symbols;
+    auto &prev    = scratch.prev;
+    auto &next    = scratch.next;
+    auto &heap    = scratch.heap;
+
+    symbols.resize(word_size);
+    prev.resize(word_size);
+    next.resize(word_size);
+    heap.clear();
+
+    // Map each character into its initial symbol ID
+    for (auto i = decltype(word_size){0}; i < word_size; ++i) {
+        const auto c = word[i];
+
+        // Sanity check
+        if ((this->eow).size() == 1 and c == (this->eow).front()) {
+            throw runtime_error("bpe_tokenizer_t::encode(): found end-of-word character token in the input text. This is not supported: please change the end-of-word character to something not present in the training text.");
         }
+
+        const auto &table = (i == word_size - 1) ? (this->char_eow2id) : (this->char2id);
+        symbols[i] = table[static_cast<unsigned char>(c)];
+
+        if (symbols[i] == (this->unk).second) {
+            cerr << "Unknown token '" << c << ((i == word_size - 1) ? (this->eow) : "")
+                 << "': setting ID to 'unknown' token ID " << (this->unk).second << endl;
+        }
+
+        prev[i] = (i == 0)             ? none : i - 1;
+        next[i] = (i == word_size - 1) ? none : i + 1;
     }
 
+    const auto heap_cmp = greater<pair<size_t, size_t>>();
 
-    /* --------------------
-     * 3. Tokenize the text
-     * -------------------- */
-    // Get the number of tokens in the input text
-    size_t ntokens = 0;
-    for (const auto &word_strvec : words_list) {
-        for (const auto &token : word_strvec) {
-            // Sanity check
-            if (token == (this->eow)) {
-                throw runtime_error("bpe_tokenizer_t::encode(): found end-of-word character token in the input text. This is not supported: please change the end-of-word character to something not present in the training text.");
-                return vector<size_t>();  // Not reached
+    // Push the pair starting at position 'pos' if it can be merged
+    const auto push_pair = [&](const size_t &pos, const size_t &min_rank) {
+        const auto pos_next = next[pos];
+
+        if (pos_next != none) {
+            const auto it = (this->merges).find(symbolpair_t(symbols[pos], symbols[pos_next]));
+
+            if (it != (this->merges).end() and it->second.first >= min_rank) {
+                heap.emplace_back(it->second.first, pos);
+                push_heap(heap.begin(), heap.end(), heap_cmp);
             }
-            ++ntokens;
         }
+    };
+
+    for (auto i = decltype(word_size){0}; i < word_size; ++i) {
+        push_pair(i, 0);
     }
 
-    vector<size_t> tokenIDs(ntokens);
-    size_t m = 0;
-
-    for (const auto &word_strvec : words_list) {
-        for (const auto &token : word_strvec) {
-            /* Convert the token into the ID if found in the vocabulary,
-             * otherwise set the ID to 'unknown'                                */
-            try {
-                /* NOTE: the at() method on the RHS throws an exception if the
-                 *       token is not in the token-to-ID vocabulary             */
-                tokenIDs.at(m) = (this->vocab_token2id).at(token);
-            } catch (const exception &e) {
-                tokenIDs.at(m) = (this->unk).second;
-                cerr << "Unknown token '" << token << "': setting ID to 'unknown' token ID "
-                     << (this->unk).second << " (exception: \"" << e.what() << "\")" << endl;
-            }
+    while (not heap.empty()) {
+        pop_heap(heap.begin(), heap.end(), heap_cmp);
+        const auto [rank, pos] = heap.back();
+        heap.pop_back();
+
+        // Discard stale entries
+        if (symbols[pos] == none or next[pos] == none) {
+            continue;
+        }
+
+        const auto pos_next = next[pos];
+        const auto it       = (this->merges).find(symbolpair_t(symbols[pos], symbols[pos_next]));
 
-            ++m;
+        if (it == (this->merges).end() or it->second.first != rank) {
+            continue;
         }
+
+        // Merge the pair into the symbol at 'pos' and unlink 'pos_next'
+        symbols[pos]      = it->second.second;
+        symbols[pos_next] = none;
+        next[pos]         = next[pos_next];
+
+        if (next[pos] != none) {
+            prev[next[pos]] = pos;
+        }
+
+        if (prev[pos] != none) {
+            push_pair(prev[pos], rank + 1);
+        }
+
+        push_pair(pos, rank + 1);
     }
 
-    return tokenIDs;
+    for (auto pos = decltype(word_size){0}; pos != none; pos = next[pos]) {
+        ids.emplace_back(symbols[pos]);
+    }
+
+    return;
 }
 
 
 
 /* ========================================================================
- * Decode method using the ID-to-token vocabulary to convert a set of input
+ * Decode methods using the ID-to-token vocabulary to convert a set of input
  * token IDs into the corresponding text tokens
  * ========================================================================= */
-string bpe_tokenizer_t::decode(const vector<size_t> &ids) {
-    ostringstream decoded_text_ss;
+string bpe_tokenizer_t::decode(const vector<size_t> &ids) const {
+    string text;
+    decode(ids, text);
+    return text;
+}
+
+
+void bpe_tokenizer_t::decode(const vector<size_t> &ids,
+                             string               &text) const {
+    const auto nids_vocab = (this->vocab).size();
 
     for (const auto &id : ids) {
-        try {
-            // NOTE: no extra space separating tokens
-            decoded_text_ss << (this->vocab_id2token).at(id);
-        } catch (const exception &e) {
+        if (id >= nids_vocab) {
             ostringstream exception_ss;
             exception_ss << "bpe_tokenizer_t::decode(): unknown token ID " << id
-                         << ": this should never happen because the 'unknown' token should be part of the dictionary. Please check the code's correctness (exception: \""
-                         << e.what() << "\")";
+                         << ": this should never happen because the 'unknown' token should be part of the dictionary. Please check the code's correctness";
             throw runtime_error(exception_ss.str());
-            return string();  // Not reached
+            return;  // Not reached
         }
+
+        text.append((this->vocab).token(id));
     }
 
-    return decoded_text_ss.str();
+    return;
+}
+
+
+
+/* ===========================================================================
+ * Method creating an incremental decoder fed one token ID at a time
+ * =========================================================================== */
+token_decoder_t bpe_tokenizer_t::decoder(ostream *sink) const {
+    return token_decoder_t((this->vocab), "", sink);
 }
@@ -0,0 +1,60 @@
+#include <vector>
+#include <string>
+#include <mutex>
+#include <shared_mutex>
+#include <atomic>
+
+#include "Types.hh"
+
+using namespace std;
+
+
+/* ===========
+ * Constructor
+ * =========== */
+encode_cache_t::encode_cache_t(const size_t &capacity)
+    : capacity_per_shard((capacity + nshards - 1)/nshards),
+      hits(0),
+      misses(0) {}
+
+
+
+/* ===============================================================
+ * Method looking a word up in the cache and appending its token
+ * IDs to 'ids' if found
+ * =============================================================== */
+bool encode_cache_t::find(const string   &word,
+                          vector<size_t> &ids) const {
+    const auto &sh = shard(word);
+    shared_lock<shared_mutex> lock(sh.mtx);
+
+    const auto it = sh.word2ids.find(word);
+
+    if (it == sh.word2ids.end()) {
+        misses.fetch_add(1, memory_order_relaxed);
+        return false;
+    }
+
+    ids.insert(ids.end(), it->second.begin(), it->second.end());
+    hits.fetch_add(1, memory_order_relaxed);
+    return true;
+}
+
+
+
+/* ====================================================
+ * Method caching the token IDs of a word, if there is
+ * still room for it in the corresponding shard
+ * ==================================================== */
+void encode_cache_t::insert(const string &word,
+                            const size_t *ids_begin,
+                            const size_t *ids_end) {
+    auto &sh = shard(word);
+    unique_lock<shared_mutex> lock(sh.mtx);
+
+    if (sh.word2ids.size() < (this->capacity_per_shard)) {
+        sh.word2ids.emplace(word, vector<size_t>(ids_begin, ids_end));
+    }
+
+    return;
+}
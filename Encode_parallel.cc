@@ -0,0 +1,58 @@
+#include <vector>
+#include <string_view>
+#include <functional>
+#include <algorithm>
+
+#include "Types.hh"
+#include "include/Declare_functions.hh"
+
+using namespace std;
+
+
+/* =============================================================================
+ * Function encoding a text in parallel. The text is split into one chunk per
+ * thread, each cut at a word boundary, so that each chunk can be encoded
+ * independently of the others. Each thread encodes its own chunk into a
+ * thread-local vector; then, the exact position of each chunk's token IDs in
+ * the output is computed from the chunk sizes and the chunks are copied into
+ * the (preallocated) output in parallel. The result is identical to encoding
+ * the whole text serially.
+ * ============================================================================= */
+vector<size_t> encode_parallel(const string_view &text,
+                               thread_pool_t     &pool,
+                               const function<void(const string_view&, vector<size_t>&)> &encode) {
+    const auto nchunks = pool.size();
+    const auto size    = text.size();
+
+    // Chunk boundaries, moved back to the closest word boundary
+    vector<size_t> cuts(nchunks + 1);
+    cuts.at(0)       = 0;
+    cuts.at(nchunks) = size;
+
+    for (auto c = decltype(nchunks){1}; c < nchunks; ++c) {
+        const auto prev   = cuts.at(c-1);
+        const auto target = max(prev, c*(size/nchunks));
+        cuts.at(c) = prev + pretokenizer_t::last_boundary(text.substr(prev, target - prev));
+    }
+
+    vector<vector<size_t>> chunk_ids(nchunks);
+
+    pool.run([&](const size_t &c) {
+        encode(text.substr(cuts.at(c), cuts.at(c+1) - cuts.at(c)), chunk_ids.at(c));
+    });
+
+    // Position of each chunk's token IDs in the output
+    vector<size_t> offsets(nchunks + 1, 0);
+
+    for (auto c = decltype(nchunks){0}; c < nchunks; ++c) {
+        offsets.at(c+1) = offsets.at(c) + chunk_ids.at(c).size();
+    }
+
+    vector<size_t> ids(offsets.at(nchunks));
+
+    pool.run([&](const size_t &c) {
+        copy(chunk_ids.at(c).begin(), chunk_ids.at(c).end(), ids.begin() + offsets.at(c));
+    });
+
+    return ids;
+}
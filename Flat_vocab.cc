@@ -0,0 +1,165 @@
+#include <cstdint>
+#include <vector>
+#include <string>
+#include <string_view>
+#include <sstream>
+#include <memory>
+#include <functional>
+#include <stdexcept>
+#include <limits>
+
+#include "Types.hh"
+
+using namespace std;
+
+
+/* ==========================================================
+ * Constructors of an empty vocabulary and of a vocabulary
+ * stored in external memory
+ * ========================================================== */
+flat_vocab_t::flat_vocab_t()
+    : offsets_owned(1, 0),
+      arena_external(nullptr),
+      offsets_external(nullptr),
+      ntokens(0),
+      slots(16, 0) {}
+
+
+flat_vocab_t::flat_vocab_t(const uint64_t        *offsets,
+                           const char            *arena,
+                           const size_t          &ntokens,
+                           shared_ptr<const void> keepalive)
+    : arena_external(arena),
+      offsets_external(offsets),
+      ntokens(ntokens),
+      keepalive(move(keepalive)) {
+    if (not (this->keepalive)) {
+        throw runtime_error("flat_vocab_t(): external storage must be kept alive by a non-null owner");
+    }
+
+    if (ntokens >= numeric_limits<uint32_t>::max()) {
+        throw runtime_error("flat_vocab_t(): too many tokens");
+    }
+
+    // Hash table with a load factor of at most 1/2
+    size_t nslots = 16;
+
+    while (nslots < 2*ntokens) {
+        nslots *= 2;
+    }
+
+    (this->slots).assign(nslots, 0);
+
+    for (auto id = decltype(ntokens){0}; id < ntokens; ++id) {
+        if (find(token(id)) != npos) {
+            ostringstream exception_ss;
+            exception_ss << "flat_vocab_t(): repeated token '" << token(id) << "'";
+            throw runtime_error(exception_ss.str());
+        }
+
+        insert_slot(id);
+    }
+}
+
+
+
+/* ==================================
+ * Bounds-checked ID-to-token lookup
+ * ================================== */
+string_view flat_vocab_t::at(const size_t &id) const {
+    if (id >= (this->ntokens)) {
+        ostringstream exception_ss;
+        exception_ss << "flat_vocab_t::at(): token ID " << id << " out of range (vocabulary size: "
+                     << (this->ntokens) << ")";
+        throw out_of_range(exception_ss.str());
+    }
+
+    return token(id);
+}
+
+
+
+/* ===================================================
+ * Token-to-ID lookup probing the hash table linearly
+ * starting from the token's hash
+ * =================================================== */
+size_t flat_vocab_t::find(const string_view &tok) const {
+    const auto mask = (this->slots).size() - 1;
+
+    for (auto slot = hash<string_view>{}(tok) & mask; ; slot = (slot + 1) & mask) {
+        const auto entry = (this->slots)[slot];
+
+        if (entry == 0) {
+            return npos;
+        }
+
+        if (token(entry - 1) == tok) {
+            return entry - 1;
+        }
+    }
+}
+
+
+
+/* ===============================================================
+ * Method inserting a new token into an owned vocabulary, growing
+ * the hash table if its load factor would exceed 1/2
+ * =============================================================== */
+pair<size_t, bool> flat_vocab_t::insert(const string_view &tok) {
+    if (this->keepalive) {
+        throw runtime_error("flat_vocab_t::insert(): the vocabulary is read-only");
+    }
+
+    const auto id_found = find(tok);
+
+    if (id_found != npos) {
+        return {id_found, false};
+    }
+
+    const auto id = (this->ntokens);
+
+    if (id + 1 >= numeric_limits<uint32_t>::max()) {
+        throw runtime_error("flat_vocab_t::insert(): too many tokens");
+    }
+
+    (this->arena_owned).append(tok);
+    (this->offsets_owned).emplace_back((this->arena_owned).size());
+    ++(this->ntokens);
+
+    if (2*(this->ntokens) > (this->slots).size()) {
+        rehash(2*(this->slots).size());
+    } else {
+        insert_slot(id);
+    }
+
+    return {id, true};
+}
+
+
+
+/* ===================================================
+ * Helpers inserting an ID into the hash table and
+ * rebuilding the hash table with a different size
+ * =================================================== */
+void flat_vocab_t::insert_slot(const size_t &id) {
+    const auto mask = (this->slots).size() - 1;
+    auto       slot = hash<string_view>{}(token(id)) & mask;
+
+    while ((this->slots)[slot] != 0) {
+        slot = (slot + 1) & mask;
+    }
+
+    (this->slots)[slot] = static_cast<uint32_t>(id + 1);
+    return;
+}
+
+
+void flat_vocab_t::rehash(const size_t &nslots) {
+    (this->slots).assign(nslots, 0);
+
+    for (auto id = decltype(ntokens){0}; id < (this->ntokens); ++id) {
+        insert_slot(id);
+    }
+
+    return;
+}
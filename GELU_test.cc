@@ -0,0 +1,157 @@
+#include <cstdlib>
+#include <cmath>
+#include <vector>
+#include <random>
+#include <algorithm>
+#include <iostream>
+
+#include "Types.hh"
+#include "Parameters.hh"
+
+// Kernels compiled for the baseline instruction set, with the same flags as Kernels.cc
+#define KERNELS_TABLE kernels_test
+#define KERNELS_ISA   "test"
+#include "Kernels_impl.hh"
+
+using namespace std;
+
+
+/* -----------------------------------------------------------------------------
+ * Accuracy test of the fast tanh() approximation and of the GELU kernel using
+ * it vs. the C library tanh() path, over [-30, 30] (a uniform grid plus random
+ * points, plus tiny and special arguments). Fails (non-zero exit code) if the
+ * largest differences exceed the bounds documented in include/Kernels_impl.hh:
+ * 4.e-16 for tanh, 4.e-16*max(1, |x|) for GELU, and 6.e-15 for its derivative.
+ * ----------------------------------------------------------------------------- */
+
+namespace {
+
+constexpr double x_max         = 30.;
+constexpr double grid_step     = 1.e-5;
+constexpr size_t nrandom       = 2000000;
+constexpr size_t batch_size    = 4096;
+constexpr double tanh_bound    = 4.e-16;
+constexpr double GELU_bound    = 4.e-16;
+constexpr double GELU_pr_bound = 6.e-15;
+
+struct max_errors_t {
+    double tanh      = 0.;
+    double GELU      = 0.;
+    double GELU_pr   = 0.;
+    double tanh_x    = 0.;  // Arguments giving the largest errors
+    double GELU_x    = 0.;
+    double GELU_pr_x = 0.;
+};
+
+
+/* ==========================================================================
+ * Routine running a batch of arguments through fast_tanh() and the GELU
+ * kernel and updating the largest differences vs. the C library tanh() path
+ * ========================================================================== */
+void check_batch(const vector<double> &xs,
+                 max_errors_t         &errors) {
+    constexpr double sqrt_2_over_pi = std::sqrt(2./M_PI);
+    constexpr double a              = 0.044715;
+
+    vector<double> vec(xs), vec_prime(xs.size());
+    GELU_approx_kernel(vec.data(), vec_prime.data(), xs.size());
+
+    for (auto i = decltype(xs.size()){0}; i < xs.size(); ++i) {
+        const auto x = xs[i];
+
+        const auto tanh_err = fabs(fast_tanh(x) - tanh(x));
+
+        if (tanh_err > errors.tanh) {
+            errors.tanh   = tanh_err;
+            errors.tanh_x = x;
+        }
+
+        // Reference: same formulas as in GELU_approx_kernel(), with the C library tanh()
+        const auto x2      = x*x;
+        const auto th      = tanh(sqrt_2_over_pi*x*(1. + a*x2));
+        const auto thp1    = th + 1.;
+        const auto GELU    = 0.5*x*thp1;
+        const auto GELU_pr = 0.5*(thp1 + sqrt_2_over_pi*x*(1. + 3.*a*x2)*(1. - th*th));
+
+        const auto GELU_err    = fabs(vec[i] - GELU)/max(1., fabs(x));
+        const auto GELU_pr_err = fabs(vec_prime[i] - GELU_pr);
+
+        if (GELU_err > errors.GELU) {
+            errors.GELU   = GELU_err;
+            errors.GELU_x = x;
+        }
+
+        if (GELU_pr_err > errors.GELU_pr) {
+            errors.GELU_pr   = GELU_pr_err;
+            errors.GELU_pr_x = x;
+        }
+    }
+
+    return;
+}
+
+}  // namespace
+
+
+
+int main() {
+    max_errors_t   errors;
+    vector<double> xs;
+    xs.reserve(batch_size);
+
+    const auto flush = [&]() {
+        check_batch(xs, errors);
+        xs.clear();
+    };
+
+    const auto add = [&](const double &x) {
+        xs.push_back(x);
+
+        if (xs.size() == batch_size) {
+            flush();
+        }
+    };
+
+    // Uniform grid
+    const auto ngrid = static_cast<size_t>(2.*x_max/grid_step);
+
+    for (auto i = decltype(ngrid){0}; i <= ngrid; ++i) {
+        add(-x_max + static_cast<double>(i)*grid_step);
+    }
+
+    // Random points, over the whole range and close to 0
+    mt19937_64 gen(1);
+    uniform_real_distribution<double> dist(-x_max, x_max), dist_small(-1.e-3, 1.e-3);
+
+    for (auto i = decltype(nrandom){0}; i < nrandom; ++i) {
+        add(dist(gen));
+        add(dist_small(gen));
+    }
+
+    // Tiny and special arguments
+    for (const auto &x : {0., -0., 1.e-300, -1.e-300, 5.e-324, -5.e-324, 1.e-8, -1.e-8}) {
+        add(x);
+    }
+
+    flush();
+
+    // tanh() only: GELU at infinity is not finite
+    for (const auto &x : {HUGE_VAL, -HUGE_VAL}) {
+        errors.tanh = max(errors.tanh, fabs(fast_tanh(x) - tanh(x)));
+    }
+
+    const bool pass = (errors.tanh    <= tanh_bound    and
+                       errors.GELU    <= GELU_bound    and
+                       errors.GELU_pr <= GELU_pr_bound);
+
+    cout << "GELU_FAST_TANH = " << (GELU_FAST_TANH ? "true" : "false") << endl
+         << "tanh:       max error " << errors.tanh    << " at x = " << errors.tanh_x
+         << " (bound " << tanh_bound    << ")" << endl
+         << "GELU:       max error " << errors.GELU    << " at x = " << errors.GELU_x
+         << " (bound " << GELU_bound    << "*max(1, |x|))" << endl
+         << "derivative: max error " << errors.GELU_pr << " at x = " << errors.GELU_pr_x
+         << " (bound " << GELU_pr_bound << ")" << endl
+         << (pass ? "PASSED" : "FAILED") << endl;
+
+    return pass ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,262 @@
+#include <array>
+#include <algorithm>
+#include <vector>
+#include <sstream>
+#include <stdexcept>
+
+#include "Types.hh"
+#include "include/Declare_functions.hh"
+
+using namespace std;
+
+
+/* -----------------------------------------------------------------------------
+ * Cache-blocked, register-tiled matrix product. The result matrix is computed
+ * in MR x NR tiles kept in registers by the micro-kernel (the variant selected
+ * for the CPU by kernels()), which streams through blocks of the two input
+ * matrices packed into contiguous buffers:
+ *   - a KC x NC block of B is packed into strips of NR columns, which stay in
+ *     the L2/L3 cache while all the rows of A go through them;
+ *   - an MC x KC block of A is packed into strips of MR rows, which stay in
+ *     the L1/L2 cache while the micro-kernel sweeps the packed block of B.
+ * Packing also takes care of transposes, so that the micro-kernel always reads
+ * both operands with unit stride, and pads the edge strips with zeros.
+ * NOTE: each element of the result accumulates its terms in order of
+ *   increasing inner index, like the naive triple loop does, so that results
+ *   don't depend on the blocking.
+ * ----------------------------------------------------------------------------- */
+namespace {
+
+constexpr size_t MR = kernel_table_t::gemm_mr;
+constexpr size_t NR = kernel_table_t::gemm_nr;
+constexpr size_t MC = 128;
+constexpr size_t KC = 256;
+constexpr size_t NC = 2048;
+
+
+template <typename b_t>
+void pack_B(const b_t    &B,
+            const size_t &k0,
+            const size_t &kc,
+            const size_t &j0,
+            const size_t &nc,
+            double       *Bp) {
+    for (auto jb = decltype(nc){0}; jb < nc; jb += NR) {
+        const auto nr = min(NR, nc - jb);
+
+        for (auto k = decltype(kc){0}; k < kc; ++k) {
+            for (auto j = decltype(NR){0}; j < NR; ++j) {
+                *Bp++ = (j < nr) ? B(k0 + k, j0 + jb + j) : 0.;
+            }
+        }
+    }
+
+    return;
+}
+
+
+template <typename a_t>
+void pack_A(const a_t    &A,
+            const size_t &i0,
+            const size_t &mc,
+            const size_t &k0,
+            const size_t &kc,
+            double       *Ap) {
+    for (auto ib = decltype(mc){0}; ib < mc; ib += MR) {
+        const auto mr = min(MR, mc - ib);
+
+        for (auto k = decltype(kc){0}; k < kc; ++k) {
+            for (auto i = decltype(MR){0}; i < MR; ++i) {
+                *Ap++ = (i < mr) ? A(i0 + ib + i, k0 + k) : 0.;
+            }
+        }
+    }
+
+    return;
+}
+
+
+/* C(M, N) = A(M, K)*B(K, N), or C += A*B if 'accumulate' is true, with the
+ * matrices accessed through the given callables                            */
+template <typename a_t, typename b_t, typename c_t>
+void gemm_blocked(const size_t &M,
+                  const size_t &N,
+                  const size_t &K,
+                  const a_t    &A,
+                  const b_t    &B,
+                  const c_t    &C,
+                  const bool   &accumulate) {
+    if (K == 0) {
+        if (not accumulate) {
+            for (auto i = decltype(M){0}; i < M; ++i) {
+                for (auto j = decltype(N){0}; j < N; ++j) {
+                    C(i, j) = 0.;
+                }
+            }
+        }
+
+        return;
+    }
+
+    thread_local vector<double> Ap, Bp;
+    const auto &micro_kernel = kernels().gemm_micro_kernel;
+
+    for (auto j0 = decltype(N){0}; j0 < N; j0 += NC) {
+        const auto nc = min(NC, N - j0);
+
+        for (auto k0 = decltype(K){0}; k0 < K; k0 += KC) {
+            const auto kc     = min(KC, K - k0);
+            const auto load_C = (accumulate or k0 > 0);
+
+            Bp.resize(((nc + NR - 1)/NR)*NR*kc);
+            pack_B(B, k0, kc, j0, nc, Bp.data());
+
+            for (auto i0 = decltype(M){0}; i0 < M; i0 += MC) {
+                const auto mc = min(MC, M - i0);
+
+                Ap.resize(((mc + MR - 1)/MR)*MR*kc);
+                pack_A(A, i0, mc, k0, kc, Ap.data());
+
+                for (auto jb = decltype(nc){0}; jb < nc; jb += NR) {
+                    const auto nr = min(NR, nc - jb);
+
+                    for (auto ib = decltype(mc){0}; ib < mc; ib += MR) {
+                        const auto mr = min(MR, mc - ib);
+                        array<double, MR*NR> acc{};
+
+                        if (load_C) {
+                            for (auto i = decltype(mr){0}; i < mr; ++i) {
+                                for (auto j = decltype(nr){0}; j < nr; ++j) {
+                                    acc[i*NR + j] = C(i0 + ib + i, j0 + jb + j);
+                                }
+                            }
+                        }
+
+                        micro_kernel(kc, Ap.data() + ib*kc, Bp.data() + jb*kc, acc.data());
+
+                        for (auto i = decltype(mr){0}; i < mr; ++i) {
+                            for (auto j = decltype(nr){0}; j < nr; ++j) {
+                                C(i0 + ib + i, j0 + jb + j) = acc[i*NR + j];
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+
+    return;
+}
+
+}  // namespace
+
+
+
+/* ============================================================================
+ * Routine computing the matrix product C = op(A)*op(B), or C += op(A)*op(B) if
+ * 'accumulate' is true, where op(X) is either X or its transpose
+ * ============================================================================ */
+void gemm(const tensor_view_t<const double> &A,
+          const tensor_view_t<const double> &B,
+          const tensor_view_t<double>       &C,
+          const bool                        &transpose_A,
+          const bool                        &transpose_B,
+          const bool                        &accumulate) {
+    const auto M  = transpose_A ? A.cols() : A.rows();
+    const auto K  = transpose_A ? A.rows() : A.cols();
+    const auto KB = transpose_B ? B.cols() : B.rows();
+    const auto N  = transpose_B ? B.rows() : B.cols();
+
+    if (K != KB or C.rows() != M or C.cols() != N) {
+        ostringstream exception_ss;
+        exception_ss << "gemm(): incompatible shapes: op(A) is (" << M << ", " << K << "), op(B) is ("
+                     << KB << ", " << N << "), C is (" << C.rows() << ", " << C.cols() << ")";
+        throw runtime_error(exception_ss.str());
+        return;  // Not reached
+    }
+
+    const auto c = [&C](const size_t &i, const size_t &j) -> double& { return C(i, j); };
+
+    const auto a_n = [&A](const size_t &i, const size_t &k) { return A(i, k); };
+    const auto a_t = [&A](const size_t &i, const size_t &k) { return A(k, i); };
+    const auto b_n = [&B](const size_t &k, const size_t &j) { return B(k, j); };
+    const auto b_t = [&B](const size_t &k, const size_t &j) { return B(j, k); };
+
+    if (transpose_A) {
+        if (transpose_B) {
+            gemm_blocked(M, N, K, a_t, b_t, c, accumulate);
+        } else {
+            gemm_blocked(M, N, K, a_t, b_n, c, accumulate);
+        }
+    } else {
+        if (transpose_B) {
+            gemm_blocked(M, N, K, a_n, b_t, c, accumulate);
+        } else {
+            gemm_blocked(M, N, K, a_n, b_n, c, accumulate);
+        }
+    }
+
+    return;
+}
+
+
+
+/* ==========================================================================
+ * Routine computing the query, key, and value matrices Q = X*Wq, K = X*Wk,
+ * and V = X*Wv at once, as a single product of X by the three weight
+ * matrices side by side, so that X is only read (and packed) once.
+ * The outputs are stored head by head: with nheads heads, head h takes
+ * columns [h*N/nheads, (h+1)*N/nheads) of X*W and stores them in rows
+ * [h*M, (h+1)*M) of the (nheads*M, N/nheads)-shaped output, so that each
+ * head's queries, keys, and values are contiguous. One head is the usual
+ * (M, N)-shaped layout.
+ * ========================================================================== */
+void gemm_qkv(const tensor_view_t<const double> &X,
+              const tensor_view_t<const double> &Wq,
+              const tensor_view_t<const double> &Wk,
+              const tensor_view_t<const double> &Wv,
+              const tensor_view_t<double>       &Q,
+              const tensor_view_t<double>       &K,
+              const tensor_view_t<double>       &V,
+              const size_t                      &nheads) {
+    const auto M = X.rows();
+    const auto D = X.cols();
+    const auto N = Wq.cols();
+
+    if (nheads == 0 or N % nheads != 0) {
+        ostringstream exception_ss;
+        exception_ss << "gemm_qkv(): the number of columns of the weight matrices (" << N
+                     << ") must be a multiple of the number of heads (" << nheads << ")";
+        throw runtime_error(exception_ss.str());
+        return;  // Not reached
+    }
+
+    const auto N_head = N/nheads;
+
+    for (const auto &W : {Wq, Wk, Wv}) {
+        if (W.rows() != D or W.cols() != N) {
+            throw runtime_error("gemm_qkv(): the weight matrices must all be (X.cols(), N)-shaped");
+            return;  // Not reached
+        }
+    }
+
+    for (const auto &out : {Q, K, V}) {
+        if (out.rows() != nheads*M or out.cols() != N_head) {
+            throw runtime_error("gemm_qkv(): the query, key, and value matrices must all be (nheads*X.rows(), N/nheads)-shaped");
+            return;  // Not reached
+        }
+    }
+
+    const array<const tensor_view_t<const double>*, 3> W   = {&Wq, &Wk, &Wv};
+    const array<const tensor_view_t<double>*,       3> out = {&Q,  &K,  &V};
+
+    const auto x = [&X](const size_t &i, const size_t &k) { return X(i, k); };
+    const auto w = [&W, &N](const size_t &k, const size_t &j) { return (*W[j/N])(k, j%N); };
+    const auto c = [&out, &N, &M, &N_head](const size_t &i, const size_t &j) -> double& {
+        const auto jW = j%N;
+        return (*out[j/N])((jW/N_head)*M + i, jW%N_head);
+    };
+
+    gemm_blocked(M, 3*N, D, x, w, c, false);
+    return;
+}
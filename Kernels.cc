@@ -0,0 +1,92 @@
+#include <cstdlib>
+#include <string>
+#include <sstream>
+#include <stdexcept>
+
+#include "Types.hh"
+#include "include/Declare_functions.hh"
+#include "Parameters.hh"
+
+// Kernels compiled for the baseline instruction set
+#define KERNELS_TABLE kernels_default
+#define KERNELS_ISA   "default"
+#include "Kernels_impl.hh"
+
+using namespace std;
+
+
+#if defined(KERNELS_X86)
+extern const kernel_table_t kernels_avx2;
+extern const kernel_table_t kernels_avx512;
+#endif
+
+
+namespace {
+
+/* ==========================================================================
+ * Select the kernel table: the one requested by the LLM_KERNELS environment
+ * variable if set, by the NUMERIC_KERNELS parameter otherwise ("auto" means
+ * the best one the CPU supports)
+ * ========================================================================== */
+const kernel_table_t &select_kernels() {
+    const auto  *env = getenv("LLM_KERNELS");
+    const string choice((env != nullptr and *env != '\0') ? env : NUMERIC_KERNELS);
+
+    #if defined(KERNELS_X86)
+    __builtin_cpu_init();
+    const bool has_avx512 = __builtin_cpu_supports("avx512f") and __builtin_cpu_supports("avx512dq");
+    const bool has_avx2   = __builtin_cpu_supports("avx2")    and __builtin_cpu_supports("fma");
+    #else
+    const bool has_avx512 = false;
+    const bool has_avx2   = false;
+    #endif
+
+    if (choice == "auto") {
+        #if defined(KERNELS_X86)
+        if (has_avx512) {
+            return kernels_avx512;
+        }
+
+        if (has_avx2) {
+            return kernels_avx2;
+        }
+        #endif
+
+        return kernels_default;
+    }
+
+    if (choice == "default") {
+        return kernels_default;
+    }
+
+    if (choice != "avx2" and choice != "avx512") {
+        ostringstream exception_ss;
+        exception_ss << "kernels(): unknown kernel variant '" << choice << "' (choices: auto, default, avx2, avx512)";
+        throw runtime_error(exception_ss.str());
+    }
+
+    if ((choice == "avx2" and not has_avx2) or (choice == "avx512" and not has_avx512)) {
+        ostringstream exception_ss;
+        exception_ss << "kernels(): the '" << choice << "' kernels are not supported by this CPU or build";
+        throw runtime_error(exception_ss.str());
+    }
+
+    #if defined(KERNELS_X86)
+    return (choice == "avx512") ? kernels_avx512 : kernels_avx2;
+    #else
+    return kernels_default;  // Not reached
+    #endif
+}
+
+}  // namespace
+
+
+
+/* ==============================================================
+ * Routine returning the numeric kernels to use, selected once on
+ * the first call
+ * ============================================================== */
+const kernel_table_t &kernels() {
+    static const auto &table = select_kernels();
+    return table;
+}
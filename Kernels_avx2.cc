@@ -0,0 +1,4 @@
+// Kernels compiled with AVX2 and FMA enabled (see CMakeLists.txt)
+#define KERNELS_TABLE kernels_avx2
+#define KERNELS_ISA   "avx2"
+#include "Kernels_impl.hh"
@@ -0,0 +1,4 @@
+// Kernels compiled with AVX-512 enabled (see CMakeLists.txt)
+#define KERNELS_TABLE kernels_avx512
+#define KERNELS_ISA   "avx512"
+#include "Kernels_impl.hh"
@@ -7,6 +7,8 @@
 #include <algorithm>
 #include <limits>
 #include <stdexcept>
+#include <string>
+#include <memory>
 
 #include "Check_parameters.hh"
 #include "Types.hh"
@@ -34,17 +36,53 @@ int main() {
     const auto   &training_text(training_text_ss.str());
     const string &input_text(INPUT_TEXT);
 
+    /* Fingerprint of the training setup, used to check whether the tokenizer
+     * saved to TOKENIZER_FILE (if any) can be reused                           */
+    auto fingerprint = fnv1a_64(training_text.data(), training_text.size());
+
     #if (TOKENIZER == WORD)
-    auto tokenizer = word_tokenizer_t(training_text);
+    using tokenizer_t = word_tokenizer_t;
     #elif (TOKENIZER == BPE)
-    auto tokenizer = bpe_tokenizer_t(training_text, BPE_END_OF_WORD, BPE_MAX_VOCAB_SIZE);
+    using tokenizer_t = bpe_tokenizer_t;
+    constexpr size_t max_vocab_size = BPE_MAX_VOCAB_SIZE;
+    const     string eow(BPE_END_OF_WORD);
+    fingerprint = fnv1a_64(&max_vocab_size, sizeof(max_vocab_size), fingerprint);
+    fingerprint = fnv1a_64(eow.data(), eow.size(), fingerprint);
     #else
     #error "Invalid tokenizer"
     return 1;  // Not reached
     #endif
 
+    /* Load the tokenizer from file if possible, otherwise train it and save it
+     * to file for the next runs                                                */
+    auto tokenizer = [&]() {
+        try {
+            const auto file = make_shared<const tokenizer_file_t>(TOKENIZER_FILE, TOKENIZER, fingerprint);
+            cout << "INFO: tokenizer loaded from file '" << TOKENIZER_FILE << "'" << endl;
+            return tokenizer_t(file);
+        } catch (const exception &e) {
+            cout << "INFO: training the tokenizer (" << e.what() << ")" << endl;
+        }
+
+        #if (TOKENIZER == WORD)
+        auto tokenizer_trained = tokenizer_t(training_text);
+        #else
+        auto tokenizer_trained = tokenizer_t(training_text, eow, max_vocab_size, NTHREADS);
+        #endif
+
+        tokenizer_trained.save(TOKENIZER_FILE, fingerprint);
+        return tokenizer_trained;
+    }();
+
+    #if (TOKENIZER == BPE)
+    tokenizer.enable_cache(BPE_ENCODE_CACHE_SIZE);
+    #endif
+
+    // Pool of threads used by the parallel parts of the code
+    thread_pool_t pool(NTHREADS);
+
     // Encode the input text into token IDs
-    const auto &ids_input = tokenizer.encode(input_text);
+    const auto &ids_input = tokenizer.encode(input_text, pool);
     const auto nids_input = ids_input.size();
 
     if (nids_input < 2) {
@@ -52,145 +90,201 @@ int main() {
         return 1;  // Not reached
     }
 
+    // The target token of each input token is the next input token
+    const vector<size_t> targets(ids_input.begin() + 1, ids_input.end());
+
+
+    /* Register all the trainable parameters of the model in one arena, which
+     * also holds their gradients, so that they can all be zeroed or updated
+     * at once. Layer normalization scales start at 1's, everything else at
+     * 0's until initialized below.
+     * NOTE: one set of scale/shift vectors per application of the layer
+     *       normalization:
+     *         1. Before the attention block
+     *         2. Before the feed-forward neural network
+     *         3. Before predicting the new token                               */
+    const auto     nids_vocab       = tokenizer.vocab.size();
+    const auto     dim_vocab        = nids_vocab*DIM;
+    constexpr auto dim_ffn_expanded = DIM*FFN_EXPANSION_FACTOR;
+
+    param_arena_t params;
+    params.add("vocab_embedding", nids_vocab, DIM);
+    params.add("pos_embeddings",  nids_input, DIM);
+
+    for (const auto *layer : {"attention", "ffn", "final"}) {
+        const string ln(layer);
+        params.add("scale_" + ln, 1, DIM, 1.);
+        params.add("shift_" + ln, 1, DIM, 0.);
+    }
+
+    for (const auto *W : {"Wq", "Wk", "Wv", "Wo"}) {
+        params.add(string(W), DIM, DIM);
+    }
+
+    params.add("ffn_W1", DIM, dim_ffn_expanded);
+    params.add("ffn_b1", 1,   dim_ffn_expanded);
+    params.add("ffn_W2", dim_ffn_expanded, DIM);
+    params.add("ffn_b2", 1,   DIM);
+
+    #if (not TIE_EMBEDDINGS)
+    params.add("logits_W", nids_vocab, DIM);
+    #endif
+    params.add("logits_b", 1, nids_vocab);
+
+    params.allocate();
+
 
     /* Initialize a vector representation ("embedding") of each token in the
      * vocabulary with random numbers (to be optimized during training later on */
-    const auto nids_vocab = tokenizer.vocab_token2id.size();
-    const auto dim_vocab  = nids_vocab*DIM;
-    vector<double> vocab_embedding(dim_vocab);
+    const auto vocab_embedding = params.param("vocab_embedding");
 
     random_device rd;
     #if (RANDOM_SEED > 0)
     cout << "INFO: seed " << RANDOM_SEED
          << " will be used to initialize the pseudo-random number generator. The LLM output will be reproducible." << endl;
     mt19937 gen(RANDOM_SEED);
+    const philox_t dropout_rng(RANDOM_SEED);
     #else
     cout << "INFO: machine entropy will be used to initialize the pseudo-random number generator. The LLM output will NOT be reproducible." << endl;
     mt19937 gen(rd());
+    const philox_t dropout_rng((static_cast<uint64_t>(rd()) << 32) | rd());
     #endif
     normal_distribution<double> ndist(0., 1./sqrt(static_cast<double>(DIM)));
 
-    for (auto &el : vocab_embedding) {
-        el = ndist(gen);
+    for (auto idx = decltype(dim_vocab){0}; idx < dim_vocab; ++idx) {
+        vocab_embedding[idx] = ndist(gen);
     }
 
 
     // Initialize the positional embedding vectors with random numbers
-    const auto dim_tot = nids_input*DIM;
-    vector<double> pos_embeddings(dim_tot);
+    const auto pos_embeddings     = params.param("pos_embeddings");
+    const auto dim_pos_embeddings = nids_input*DIM;
 
-    for (auto &el : pos_embeddings) {
-        el = ndist(gen);
+    for (auto idx = decltype(dim_pos_embeddings){0}; idx < dim_pos_embeddings; ++idx) {
+        pos_embeddings[idx] = ndist(gen);
     }
 
 
-    /* Initialize the layer normalization scale and shift vectors to 1's and
-     * and 0's, respectively
-     * NOTE: one set of scale/shift vectors per application of the layer
-     *       normalization:
-     *         1. Before the attention block
-     *         2. Before the feed-forward neural network
-     *         3. Before predicting the new token                               */
-    vector<double> scale_attention(DIM, 1.), shift_attention(DIM, 0.);
-    vector<double>       scale_ffn(DIM, 1.),       shift_ffn(DIM, 0.);
-    vector<double>     scale_final(DIM, 1.),     shift_final(DIM, 0.);
+    // Layer normalization scale and shift vectors (already initialized)
+    const auto scale_attention = params.param("scale_attention"), shift_attention = params.param("shift_attention");
+    const auto       scale_ffn = params.param("scale_ffn"),             shift_ffn = params.param("shift_ffn");
+    const auto     scale_final = params.param("scale_final"),         shift_final = params.param("shift_final");
 
 
-    /* Initialize the query, key, and value weight matrices to random values
-     * NOTE: declared as std::vector so they are allocated on the heap.
-     *       std::array allocates on the stack and this can overflow for very
-     *       large DIM*DIM.                                                     */
+    // Initialize the query, key, and value weight matrices to random values
     constexpr auto dim_sq = DIM*DIM;
-    vector<double> Wq(dim_sq), Wk(dim_sq), Wv(dim_sq);
+    const auto Wq = params.param("Wq"), Wk = params.param("Wk"), Wv = params.param("Wv");
 
     // Xavier/Glorot uniform distribution
     constexpr auto xg_dim_bound = sqrt(3./(static_cast<double>(DIM)));
     uniform_real_distribution<double> xg_dim_udist(-xg_dim_bound, xg_dim_bound);
 
     for (auto idx = decltype(dim_sq){0}; idx < dim_sq; ++idx) {
-        Wq.at(idx) = xg_dim_udist(gen);
-        Wk.at(idx) = xg_dim_udist(gen);
-        Wv.at(idx) = xg_dim_udist(gen);
+        Wq[idx] = xg_dim_udist(gen);
+        Wk[idx] = xg_dim_udist(gen);
+        Wv[idx] = xg_dim_udist(gen);
     }
 
 
-    /* Initialize a uniform real distribution in [0,1] for the dropout (only
-     * used if needed                                                           */
-    uniform_real_distribution<double> udist(0., 1.);
+    /* Initialize the output projection of the attention heads (only used, and
+     * so only drawn from the generator, with more than one head)               */
+    const auto Wo = params.param("Wo");
+
+    if constexpr (NHEADS > 1) {
+        for (auto idx = decltype(dim_sq){0}; idx < dim_sq; ++idx) {
+            Wo[idx] = xg_dim_udist(gen);
+        }
+    }
+
 
+    /* NOTE: the dropout masks come from the counter-based generator
+     *   'dropout_rng', with one stream per training iteration and dropout
+     *   layer, so they don't depend on the order they're drawn in              */
     if constexpr (DROPOUT_PROB > 0.) {
         cout << "INFO: dropout enabled with rate " << DROPOUT_PROB << endl;
     } else {
         cout << "INFO: dropout disabled" << endl;
     }
 
+    cout << "INFO: using the '" << kernels().isa << "' numeric kernels" << endl;
+
 
     /* Initialize the feed-forward neural network weights for the two layers
      * randomly, and the biases to zero
      * NOTE: think of ffn_W1 and ffn_W2 as a matrices with dimensions:
      *   - ffn_W1(DIM, DIM*FFN_EXPANSION_FACTOR)
      *   - ffn_W2(DIM*FFN_EXPANSION_FACTOR, DIM)                                */
-    constexpr auto dim_ffn_expanded = DIM*FFN_EXPANSION_FACTOR;
-    constexpr auto dim_ffn_weights  = DIM*dim_ffn_expanded;
+    constexpr auto dim_ffn_weights = DIM*dim_ffn_expanded;
 
-    vector<double> ffn_W1(dim_ffn_weights),      ffn_W2(dim_ffn_weights);
-    vector<double> ffn_b1(dim_ffn_expanded, 0.), ffn_b2(DIM, 0.);
+    const auto ffn_W1 = params.param("ffn_W1"), ffn_W2 = params.param("ffn_W2");
+    const auto ffn_b1 = params.param("ffn_b1"), ffn_b2 = params.param("ffn_b2");
 
     // Xavier/Glorot normal distribution
     constexpr auto xg_ffn_std = sqrt(6./(static_cast<double>(DIM) + static_cast<double>(dim_ffn_expanded)));
     normal_distribution<double> xg_ffn_ndist(0., xg_ffn_std);
 
     for (auto idx = decltype(dim_ffn_weights){0}; idx < dim_ffn_weights; ++idx) {
-        ffn_W1.at(idx) = xg_ffn_ndist(gen);
-        ffn_W2.at(idx) = xg_ffn_ndist(gen);
+        ffn_W1[idx] = xg_ffn_ndist(gen);
+        ffn_W2[idx] = xg_ffn_ndist(gen);
     }
 
 
     /* Initialize the logits weights to the vocabulary embedding and the biases
-     * to zero
-     * NOTE: think of 'logits_W' as a (DIM, nids_vocab)-shaped matrix           */
-    vector<double> logits_W(dim_vocab);
-    vector<double> logits_b(nids_vocab, 0.);
-
-    for (auto v = decltype(nids_vocab){0}; v < nids_vocab; ++v) {
-        const auto idx_v = v*DIM;
-        for (auto i = decltype(DIM){0}; i < DIM; ++i) {
-            logits_W.at(i*nids_vocab + v) = vocab_embedding.at(idx_v + i);
-        }
+     * to zero. With TIE_EMBEDDINGS, the logits weights are the vocabulary
+     * embedding itself, which then gets trained through the logits.
+     * NOTE: 'logits_W' is (nids_vocab, DIM)-shaped like the vocabulary
+     *       embedding, i.e., row v is the output embedding of token v          */
+    #if (TIE_EMBEDDINGS)
+    const auto logits_W = vocab_embedding;
+    #else
+    const auto logits_W = params.param("logits_W");
+
+    for (auto idx = decltype(dim_vocab){0}; idx < dim_vocab; ++idx) {
+        logits_W[idx] = vocab_embedding[idx];
     }
+    #endif
+    const auto logits_b = params.param("logits_b");
 
 
     /* Preallocate the input and context vectors, the query, key, and value
-     * matrices, and the FFN hidden and output layers, the logits vectors, the
-     * loss' gradients wrt to the model's parameters, and some helpers to
-     * improve performance                                                      */
-    vector<double> inputs(dim_tot), inputs_preFFN(dim_tot), contexts(dim_tot);
-    vector<double> queries(dim_tot), keys(dim_tot), values(dim_tot);
+     * matrices, and the FFN hidden and output layers, and some helpers to
+     * improve performance, and get the loss' gradients wrt to the model's
+     * parameters from the arena                                                */
+    tensor_t<double> inputs(nids_input, DIM), inputs_preFFN(nids_input, DIM), contexts(nids_input, DIM);
 
-    const auto dim_tot_expanded = nids_input*dim_ffn_expanded;
-    vector<double> ffn_h(dim_tot_expanded), ffn_h_prime(dim_tot_expanded);
-    vector<double> ffn_out(dim_tot);
+    /* NOTE: the queries, keys, values, and per-head context vectors are stored
+     *   head by head (head h in rows [h*nids_input, (h+1)*nids_input)); with
+     *   one head, the context vectors are written to 'contexts' directly       */
+    constexpr auto dim_head = DIM/NHEADS;
+    tensor_t<double> queries(NHEADS*nids_input, dim_head), keys(NHEADS*nids_input, dim_head), values(NHEADS*nids_input, dim_head);
+    tensor_t<double> contexts_heads((NHEADS > 1) ? NHEADS*nids_input : 0, dim_head);
 
-    vector<double> logits(nids_input*nids_vocab);
+    tensor_t<double> ffn_h(nids_input, dim_ffn_expanded), ffn_h_prime(nids_input, dim_ffn_expanded);
+    tensor_t<double> ffn_out(nids_input, DIM);
 
-    vector<double> probs_m(nids_vocab);
-    vector<double> inputs_preLN_normalized_m(DIM);
-    vector<double> sigmas_inv_preLN(nids_input);
-    vector<double> d_inputs_m(DIM);
-    vector<double> dinputs_scalefinal_m(DIM);
-    vector<double> d_ffn_b2_m(DIM);
+    tensor_t<double> inputs_preLN_normalized_m(1, DIM);
+    tensor_t<double> sigmas_inv_preLN(1, nids_input);
+    tensor_t<double> dinputs_scalefinal_m(1, DIM);
 
-    vector<double> d_ffn_b1(dim_ffn_expanded);
-    vector<double> d_ffn_W1(dim_ffn_weights);  // Matrix (DIM, dim_ffn_expanded)
+    const auto d_ffn_b1 = params.grad("ffn_b1");
+    const auto d_ffn_W1 = params.grad("ffn_W1");
 
-    vector<double> d_ffn_b2(DIM);
-    vector<double> d_ffn_W2(dim_ffn_weights);  // Matrix (dim_ffn_expanded, DIM)
+    const auto d_ffn_b2 = params.grad("ffn_b2");
+    const auto d_ffn_W2 = params.grad("ffn_W2");
 
-    vector<double> d_scale_final(DIM);
-    vector<double> d_shift_final(DIM);
+    const auto d_scale_final = params.grad("scale_final");
+    const auto d_shift_final = params.grad("shift_final");
+
+    #if (TIE_EMBEDDINGS)
+    const auto d_logits_W = params.grad("vocab_embedding");
+    #else
+    const auto d_logits_W = params.grad("logits_W");
+    #endif
+    const auto d_logits_b = params.grad("logits_b");
 
-    vector<double> d_logits_W(dim_vocab);  // Matrix (DIM, nids_vocab)
-    vector<double> d_logits_b(nids_vocab);
+    tensor_t<double> d_inputs(nids_input, DIM);
+    tensor_t<double> d_ffn_out(nids_input, DIM);
+    tensor_t<double> d_ffn_h(nids_input, dim_ffn_expanded);
 
 
     /* Write the loss function to file at every training iteration for logging
@@ -219,14 +313,11 @@ int main() {
         constexpr auto sqrt_dim = sqrt(static_cast<double>(DIM));
 
         for (auto m = decltype(nids_input){0}; m < nids_input; ++m) {
-            const auto idx_m = m*DIM;
-            const auto id_input = ids_input.at(m);
+            const auto id_input = ids_input[m];
             assert(id_input < nids_vocab);
-            const auto idx_vocab = id_input*DIM;
 
             for (auto i = decltype(DIM){0}; i < DIM; ++i) {
-                const auto mi = idx_m + i;
-                inputs.at(mi) = sqrt_dim*vocab_embedding.at(idx_vocab + i) + pos_embeddings.at(mi);
+                inputs(m, i) = sqrt_dim*vocab_embedding(id_input, i) + pos_embeddings(m, i);
             }
         }
 
@@ -240,86 +331,50 @@ int main() {
         layer_norm(inputs, scale_attention, shift_attention);
 
 
-        // Build the query, key, and value matrices
-        fill(queries.begin(), queries.end(), 0.);
-        fill(   keys.begin(),    keys.end(), 0.);
-        fill( values.begin(),  values.end(), 0.);
-
-        for (auto m = decltype(nids_input){0}; m < nids_input; ++m) {
-            const auto idx_m = m*DIM;
-
-            /* NOTE: swapping the more "natural" loop order (j out, k in) to
-             *       improve the memory access pattern in Wq, Wk, Wv            */
-            for (auto k = decltype(DIM){0}; k < DIM; ++k) {
-                const auto inputs_mk = inputs.at(idx_m + k);
-                const auto idx_k     = k*DIM;
-
-                for (auto i = decltype(DIM){0}; i < DIM; ++i) {
-                    const auto mi = idx_m + i;
-                    const auto ki = idx_k + i;
-
-                    queries.at(mi) += inputs_mk*Wq.at(ki);
-                       keys.at(mi) += inputs_mk*Wk.at(ki);
-                     values.at(mi) += inputs_mk*Wv.at(ki);
-                }
-            }
-        }
+        /* Build the query, key, and value matrices in one go, reading the
+         * inputs only once, and split them by head                             */
+        gemm_qkv(inputs, Wq, Wk, Wv, queries, keys, values, NHEADS);
 
 
         /* Compute the attention scores and the context vectors (matrix),
          * i.e., the sum of the value vectors (columns of the values matrix)
          * weighted by the attention scores along the rows of the attention
-         * matrix
-         * NOTE: no need to store the full attention matrix: only compute each
-         *       row and the corresponding context vector                       */
-        /* TODO: allow for multi-head attention; need to swap
-         *   nds_input<->nheads to allow parallelization by head. Then the
-         *   normalization factor will become 1/sqrt(DIM_OUT/nheads)            */
-        constexpr auto sqrt_dim_inv = 1./sqrt_dim;
-        fill(contexts.begin(), contexts.end(), 0.);
-
-        for (auto m = decltype(nids_input){0}; m < nids_input; ++m) {
-            const auto idx_m = m*DIM;
-
-            /* Causal attention: each token ID in the input text only attends to
-             * all the previous ones, so that the attention scores in the upper
-             * triangular part of the attention scores matrix (i.e., all the
-             * attention scores for n > m for row/token m) are zero (not even
-             * defined here)                                                    */
-            vector<double> attention_m(m+1);  // Instead of attention_m(nids)
-
-            for (auto n = decltype(nids_input){0}; n <= m; ++n) {
-                const auto idx_n = n*DIM;
-                double attention_mn = 0.;
-
-                for (auto l = decltype(DIM){0}; l < DIM; ++l) {
-                    const auto ml = idx_m + l;
-                    const auto nl = idx_n + l;
-                    attention_mn += queries.at(ml)*keys.at(nl);
+         * matrix, for each head. Causal attention: each token ID in the input
+         * text only attends to all the previous ones, so that the attention
+         * scores in the upper triangular part of the attention scores matrix
+         * (i.e., all the attention scores for n > m for row/token m) are zero.
+         * The scores are scaled by 1/sqrt(len(keys[:,1])) = 1/sqrt(DIM/NHEADS)
+         * to improve training behavior. With ATTENTION_WINDOW > 0, each token
+         * only attends to the last ATTENTION_WINDOW tokens and to the first
+         * ATTENTION_NGLOBAL ones.
+         * NOTE: the attention matrix is never stored: each row is normalized
+         *       on the fly (online softmax) while accumulating the context
+         *       vector                                                         */
+        constexpr auto sqrt_dim_head_inv = 1./sqrt(static_cast<double>(dim_head));
+        const     auto contexts_out      = (NHEADS > 1) ? contexts_heads.view() : contexts.view();
+
+        const auto attention_head = [&](const size_t &h) {
+            const auto row0 = h*nids_input;
+            causal_attention(queries.view().rows(row0, nids_input), keys.view().rows(row0, nids_input),
+                             values.view().rows(row0, nids_input), contexts_out.rows(row0, nids_input),
+                             sqrt_dim_head_inv, ATTENTION_WINDOW, ATTENTION_NGLOBAL);
+        };
+
+        if constexpr (NHEADS > 1) {
+            pool.parallel_for(NHEADS, [&](const size_t &h_begin, const size_t &h_end, const size_t&) {
+                for (auto h = h_begin; h < h_end; ++h) {
+                    attention_head(h);
                 }
+            });
 
-                /* Scale the attention score by
-                 * sqrt(len(keys[:,1]) = sqrt(DIM) to improve training behavior
-                 * later on                                                     */
-                attention_m.at(n) = attention_mn*sqrt_dim_inv;
-            }
-
-            /* Normalize the attention scores for the current token (i.e., for
-             * the current row of the attention matrix) using a stabilized
-             * softmax                                                          */
-            softmax(attention_m);
-
-            /* Calculate the context vector for the current token
-             * NOTE: swapping the more "natural" loop order (j out, n in) to
-             *       improve the memory access pattern in the values matrix     */
-            for (auto n = decltype(nids_input){0}; n <= m; ++n) {
-                const auto idx_n = n*DIM;
-                const auto attention_mn = attention_m.at(n);
-
-                for (auto i = decltype(DIM){0}; i < DIM; ++i) {
-                    contexts.at(idx_m + i) += attention_mn*values.at(idx_n + i);
-                }
+            /* Output projection of the concatenated heads, as the sum of the
+             * products of each head by the corresponding rows of Wo           */
+            for (auto h = decltype(NHEADS){0}; h < NHEADS; ++h) {
+                gemm(contexts_heads.view().rows(h*nids_input, nids_input), Wo.rows(h*dim_head, dim_head),
+                     contexts, false, false, h > 0);
             }
+        } else {
+            attention_head(0);
         }
 
 
@@ -330,89 +385,49 @@ int main() {
          *    the context vector constant.
          * *SHORTCUT CONNECTION:* add the context vectors to the corresponding
          *    input vectors to preserve the quality of the gradient flow during
-         *    the backward step                                                 */
-        skip_conn_dropout(inputs, contexts, udist, gen);
-
-        /* Another layer normalization
+         *    the backward step
+         * Then, another layer normalization, fused with the above to go
+         * through the inputs only once
          * NOTE: save inputs at this stage for the backward pass                */
-        layer_norm(inputs, scale_ffn, shift_ffn);
+        skip_conn_dropout_layer_norm(inputs, contexts, dropout_rng, philox_t::stream(it, 0),
+                                     scale_ffn, shift_ffn, pool);
         inputs_preFFN = inputs;
 
 
         /* Expanding-contracting two-layer feed-forward neural network:
          *   FFN(x) = (GELU(x*W1 + b1))*W2 + b2                                 */
         for (auto m = decltype(nids_input){0}; m < nids_input; ++m) {
-            const auto idx_m     = m*DIM;
-            const auto idx_m_exp = m*dim_ffn_expanded;
-
             for (auto r = decltype(dim_ffn_expanded){0}; r < dim_ffn_expanded; ++r) {
-                ffn_h.at(idx_m_exp + r) = ffn_b1.at(r);
-            }
-
-            for (auto i = decltype(DIM){0}; i < DIM; ++i) {
-                const auto inputs_mi = inputs.at(idx_m + i);
-                const auto idx_i_exp = i*dim_ffn_expanded;
-
-                for (auto r = decltype(dim_ffn_expanded){0}; r < dim_ffn_expanded; ++r) {
-                    ffn_h.at(idx_m_exp + r) += inputs_mi*ffn_W1.at(idx_i_exp + r);
-                }
+                ffn_h(m, r) = ffn_b1[r];
             }
         }
 
+        gemm(inputs, ffn_W1, ffn_h, false, false, true);
+
         /* Not quite GELU, just an approximation
          * NOTE: derivative of pre-GELU inputs needed for the backward pass     */
         GELU_approx(ffn_h, ffn_h_prime);
 
         for (auto m = decltype(nids_input){0}; m < nids_input; ++m) {
-            const auto idx_m     = m*DIM;
-            const auto idx_m_exp = m*dim_ffn_expanded;
-
             for (auto i = decltype(DIM){0}; i < DIM; ++i) {
-                ffn_out.at(idx_m + i) = ffn_b2.at(i);
-            }
-
-            for (auto r = decltype(dim_ffn_expanded){0}; r < dim_ffn_expanded; ++r) {
-                const auto ffn_h_mr = ffn_h.at(idx_m_exp + r);
-                const auto idx_r    = r*DIM;
-
-                for (auto i = decltype(DIM){0}; i < DIM; ++i) {
-                    ffn_out.at(idx_m + i) += ffn_h_mr*ffn_W2.at(idx_r + i);
-                }
+                ffn_out(m, i) = ffn_b2[i];
             }
         }
 
+        gemm(ffn_h, ffn_W2, ffn_out, false, false, true);
 
-        /* Apply dropout (if enabled) to the network's output and set up a skip
-         * connection between that and the input vectors                        */
-        skip_conn_dropout(inputs, ffn_out, udist, gen);
 
-
-        /* Final layer normalization
+        /* Apply dropout (if enabled) to the network's output, set up a skip
+         * connection between that and the input vectors, and apply the final
+         * layer normalization, all in one go
          * NOTE: save the inverse standard deviations for each input token for
          *   the backward step. The pre-layer-norm inputs will also be needed
          *   but they will be reconstructed as they are too many to be stored
          *   while cheap to recalculate.                                        */
-        layer_norm(inputs, scale_final, shift_final, &sigmas_inv_preLN);
-
-
-        // Build the logits vector for each input token
-        for (auto m = decltype(nids_input){0}; m < nids_input; ++m) {
-            const auto idx_m       = m*DIM;
-            const auto idx_m_vocab = m*nids_vocab;
+        const auto sigmas_inv_preLN_view = sigmas_inv_preLN.view();
+        skip_conn_dropout_layer_norm(inputs, ffn_out, dropout_rng, philox_t::stream(it, 1),
+                                     scale_final, shift_final, pool, &sigmas_inv_preLN_view);
 
-            for (auto v = decltype(nids_vocab){0}; v < nids_vocab; ++v) {
-                logits.at(idx_m_vocab + v) = logits_b.at(v);
-            }
-
-            for (auto i = decltype(DIM){0}; i < DIM; ++i) {
-                const auto idx_i_vocab = i*nids_vocab;
-                const auto inputs_mi   = inputs.at(idx_m + i);
-
-                for (auto v = decltype(nids_vocab){0}; v < nids_vocab; ++v) {
-                    logits.at(idx_m_vocab + v) += inputs_mi*logits_W.at(idx_i_vocab + v);
-                }
-            }
-        }
 
         // XXX XXX XXX XXX XXX XXX
         // XXX XXX XXX XXX XXX XXX
@@ -432,94 +447,33 @@ int main() {
         /* -------------------
          * TODO: backward pass
          * ------------------- */
-        /* Compute the cross-entropy loss between the input and the target
-         * tokens, where the "target" token of each input token is just the next
-         * input token. Meanwhile, accumulate the terms needed to later
-         * calculate the gradients of the loss wrt the logits' weights and
-         * biases.                                                              */
-        double loss = 0.;
-
-        fill(d_ffn_b1.begin(), d_ffn_b1.end(), 0.);
-        fill(d_ffn_W1.begin(), d_ffn_W1.end(), 0.);
+        params.zero_grad();
 
-        fill(d_ffn_b2.begin(), d_ffn_b2.end(), 0.);
-        fill(d_ffn_W2.begin(), d_ffn_W2.end(), 0.);
+        /* Only the first nids_input-1 tokens have a target token, and so
+         * contribute to the loss and to its gradients                          */
+        const auto ntargets = nids_input - 1;
 
-        fill(d_scale_final.begin(), d_scale_final.end(), 0.);
-        fill(d_shift_final.begin(), d_shift_final.end(), 0.);
 
-        fill(d_logits_b.begin(), d_logits_b.end(), 0.);
-        fill(d_logits_W.begin(), d_logits_W.end(), 0.);
+        /* Build the logits vector for each input token and compute the
+         * cross-entropy loss between the input and the target tokens, where
+         * the "target" token of each input token is just the next input token,
+         * and the loss' gradients wrt the logits' weights and biases and wrt
+         * the final inputs. The loss term for input token m is
+         *   -log(softmax(logits[m])[targets[m]]) =
+         *   = -logits[m][targets[m]] + log(sum_v exp(logits[m][v])) ,
+         * and the loss' gradient wrt the logits is softmax(logits[m]) minus 1
+         * for the target token.
+         * NOTE: the logits are computed and consumed a shard of the vocabulary
+         *       at a time, with shards split across threads, so the full
+         *       logits matrix is never stored                                  */
+        const auto inputs_targets   = inputs.view().rows(0, ntargets);
+        const auto d_inputs_targets = d_inputs.view().rows(0, ntargets);
 
-
-        for (auto m = decltype(nids_input){0}; m < nids_input - 1; ++m) {
-            const auto idx_m       = m*DIM;
-            const auto idx_m_vocab = m*nids_vocab;
-            const auto idx_m_exp   = m*dim_ffn_expanded;
-
-            // Find the largest logit for the current input token
-            double logits_m_max = -numeric_limits<double>::infinity();
-
-            for (auto v = decltype(nids_vocab){0}; v < nids_vocab; ++v) {
-                const auto logits_mv = logits.at(idx_m_vocab + v);
-                if (logits_mv > logits_m_max) {
-                    logits_m_max = logits_mv;
-                }
-            }
-
-            /* Build the log of the sum of the stabilized exponentials of all
-             * the logits for the current input token                           */
-            double sum_exp_m = 0.;
-
-            for (auto v = decltype(nids_vocab){0}; v < nids_vocab; ++v) {
-                const auto exp_term = exp(logits.at(idx_m_vocab + v) - logits_m_max);
-                probs_m.at(v) = exp_term;  // NOTE: not yet normalized by sum_exp_m
-                sum_exp_m    += exp_term;
-            }
-
-            assert(sum_exp_m > 0.);
-            const auto log_sum_exp_m = log(sum_exp_m);
-
-            /* Add the loss term for the current input token
-             * NOTE: letting
-             *   z[m][v+1] = logits.at(idx_m_vocab + ids_input.at(m+1))
-             *   be the logit corresponding to the next input token, the
-             *   expression below is equivalent to
-             *
-             *       -log(exp(z[m][v+1] - logits_m_max)) + log_sum_exp_m  =
-             *   = -( log(exp(z[m][v+1] - logits_m_max)) - log_sum_exp_m) =
-             *   = -log( (exp(z[m][v+1] - logits_m_max)) / sum_exp_m) ,
-             *
-             *  which implicitly applies softmax normalization to each logit to
-             *  convert it into a probability                                   */
-            const auto next_input_id = ids_input.at(m+1);
-            loss += -(logits.at(idx_m_vocab + next_input_id) - logits_m_max) + log_sum_exp_m;
-
-
-            /* Normalize the softmax probabilities for each logit in the logits
-             * vector for the current input token (i.e., for the current m
-             * index) and accumulate the loss' gradients wrt the logits' weights
-             * and biases and wrt the final inputs                              */
-            fill(d_inputs_m.begin(), d_inputs_m.end(), 0.);
-
-            for (auto v = decltype(nids_vocab){0}; v < nids_vocab; ++v) {
-                auto probs_mv = probs_m.at(v);
-                probs_mv     /= sum_exp_m;
-
-                if (v == next_input_id) {
-                    probs_mv -= 1.;
-                }
-
-                d_logits_b.at(v) += probs_mv;
-
-                for (auto i = decltype(DIM){0}; i < DIM; ++i) {
-                    const auto iv = i*nids_vocab + v;
-                    d_logits_W.at(iv) += probs_mv*inputs.at(idx_m + i);
-                    d_inputs_m.at(i)  += probs_mv*logits_W.at(iv);
-                }
-            }
+        double loss = logits_cross_entropy(inputs_targets, targets, logits_W, logits_b,
+                                           d_logits_W, d_logits_b, d_inputs_targets, pool);
 
 
+        for (auto m = decltype(ntargets){0}; m < ntargets; ++m) {
             /* Recover the pre-final-layer-norm input vector (shifted by its
              * mean and scaled by its standard deviation) for the current input
              * token. Meanwhile, accumulate the loss' gradient wrt the post-FFN
@@ -529,58 +483,59 @@ int main() {
             auto dinputs_scalefinal_inputspreLN_m_sum = 0.;
 
             for (auto i = decltype(DIM){0}; i < DIM; ++i) {
-                const auto d_inputs_mi   = d_inputs_m.at(i);
-                const auto scale_final_i = scale_final.at(i);
+                const auto d_inputs_mi   = d_inputs(m, i);
+                const auto scale_final_i = scale_final[i];
 
                 const auto input_preLN_normalized_mi = (scale_final_i > TOLERANCE) ?
-                    (inputs.at(idx_m + i) - shift_final.at(i))/scale_final_i       :
+                    (inputs(m, i) - shift_final[i])/scale_final_i                  :
                     0.;
-                inputs_preLN_normalized_m.at(i) = input_preLN_normalized_mi;
+                inputs_preLN_normalized_m[i] = input_preLN_normalized_mi;
 
-                d_shift_final.at(i) += d_inputs_mi;
-                d_scale_final.at(i) += d_inputs_mi*input_preLN_normalized_mi;
+                d_shift_final[i] += d_inputs_mi;
+                d_scale_final[i] += d_inputs_mi*input_preLN_normalized_mi;
 
                 const auto dinputs_scalefinal_mi      = d_inputs_mi*scale_final_i;
-                dinputs_scalefinal_m.at(i)            = dinputs_scalefinal_mi;
+                dinputs_scalefinal_m[i]               = dinputs_scalefinal_mi;
                 dinputs_scalefinal_m_sum             += dinputs_scalefinal_mi;
                 dinputs_scalefinal_inputspreLN_m_sum += dinputs_scalefinal_mi*input_preLN_normalized_mi;
             }
 
 
-            // Build the loss gradients wrt to the FFN weights and biases
-            const auto sigma_inv_preLN_m = sigmas_inv_preLN.at(m);
+            /* Loss' gradient wrt the FFN output (i.e., wrt the FFN's output
+             * biases) for the current input token                              */
+            const auto sigma_inv_preLN_m = sigmas_inv_preLN[m];
 
             for (auto i = decltype(DIM){0}; i < DIM; ++i) {
-                const auto idx_i_exp   = i*dim_ffn_expanded;
-                const auto d_ffn_b2_mi = (dinputs_scalefinal_m.at(i)
-                    - (dinputs_scalefinal_m_sum + dinputs_scalefinal_inputspreLN_m_sum*inputs_preLN_normalized_m.at(i))/static_cast<double>(DIM)
+                const auto d_ffn_b2_mi = (dinputs_scalefinal_m[i]
+                    - (dinputs_scalefinal_m_sum + dinputs_scalefinal_inputspreLN_m_sum*inputs_preLN_normalized_m[i])/static_cast<double>(DIM)
                     )*sigma_inv_preLN_m;
 
-                d_ffn_b2_m.at(i) = d_ffn_b2_mi;
-                d_ffn_b2.at(i)  += d_ffn_b2_mi;
-
-                for (auto r = decltype(dim_ffn_expanded){0}; r < dim_ffn_expanded; ++r) {
-                    d_ffn_W2.at(r*DIM + i) += d_ffn_b2_mi*ffn_h.at(idx_m_exp + r);
-                }
+                d_ffn_out(m, i) = d_ffn_b2_mi;
+                d_ffn_b2[i]    += d_ffn_b2_mi;
             }
+        }
 
 
-            for (auto r = decltype(dim_ffn_expanded){0}; r < dim_ffn_expanded; ++r) {
-                const auto idx_r  = r*DIM;
-                double d_ffn_b1_r = 0.;
+        /* Build the loss gradients wrt to the FFN weights and biases:
+         *   d_ffn_W2 = ffn_h^T*d_ffn_out
+         *   d_ffn_h  = (d_ffn_out*ffn_W2^T) (element-wise times) GELU'(ffn_h)
+         *   d_ffn_b1 = sum of the rows of d_ffn_h
+         *   d_ffn_W1 = inputs_preFFN^T*d_ffn_h                                 */
+        const auto d_ffn_out_targets = d_ffn_out.view().rows(0, ntargets);
+        const auto d_ffn_h_targets   = d_ffn_h.view().rows(0, ntargets);
 
-                for (auto j = decltype(DIM){0}; j < DIM; ++j) {
-                    d_ffn_b1_r += d_ffn_b2_m.at(j)*ffn_W2.at(idx_r + j)*ffn_h_prime.at(idx_m_exp + r);
-                }
-
-                d_ffn_b1.at(r) += d_ffn_b1_r;
+        gemm(ffn_h.view().rows(0, ntargets), d_ffn_out_targets, d_ffn_W2,        true,  false);
+        gemm(d_ffn_out_targets,              ffn_W2,            d_ffn_h_targets, false, true);
 
-                for (auto i = decltype(DIM){0}; i < DIM; ++i) {
-                    d_ffn_W1.at(i*dim_ffn_expanded + r) += d_ffn_b1_r*inputs_preFFN.at(idx_m + i);
-                }
+        for (auto m = decltype(ntargets){0}; m < ntargets; ++m) {
+            for (auto r = decltype(dim_ffn_expanded){0}; r < dim_ffn_expanded; ++r) {
+                d_ffn_h(m, r) *= ffn_h_prime(m, r);
+                d_ffn_b1[r]   += d_ffn_h(m, r);
             }
         }
 
+        gemm(inputs_preFFN.view().rows(0, ntargets), d_ffn_h_targets, d_ffn_W1, true, false);
+
 
         // Compute average loss and update the model's parameters
         auto norm_fac = 1./static_cast<double>(nids_input-1);
@@ -589,30 +544,11 @@ int main() {
 
         loss_file << it << "\t" << loss << endl;
 
-        for (auto r = decltype(dim_ffn_expanded){0}; r < dim_ffn_expanded; ++r) {
-            ffn_b1.at(r) -= norm_fac*d_ffn_b1.at(r);
-        }
-
-        for (auto i = decltype(DIM){0}; i < DIM; ++i) {
-            ffn_b2.at(i)      -= norm_fac*d_ffn_b2.at(i);
-            scale_final.at(i) -= norm_fac*d_scale_final.at(i);
-            shift_final.at(i) -= norm_fac*d_shift_final.at(i);
-        }
-
-        for (auto idx = decltype(dim_ffn_weights){0}; idx < dim_ffn_weights; ++idx) {
-            ffn_W1.at(idx) -= norm_fac*d_ffn_W1.at(idx);
-            ffn_W2.at(idx) -= norm_fac*d_ffn_W2.at(idx);
-        }
-
-        for (auto v = decltype(nids_vocab){0}; v < nids_vocab; ++v) {
-            logits_b.at(v) -= norm_fac*d_logits_b.at(v);
-        }
-
-        for (auto idx = decltype(dim_vocab){0}; idx < dim_vocab; ++idx) {
-            logits_W.at(idx) -= norm_fac*d_logits_W.at(idx);
-        }
+        /* Update all the parameters at once (those without gradients, e.g.,
+         * the attention weights, are left as they are)                         */
+        params.sgd_step(norm_fac, pool);
 
-        // TODO: update all the other weights in the model
+        // TODO: compute the gradients wrt all the other parameters in the model
 
         #if (VERBOSE)
         cout << "Training epoch " << it << " completed" << endl;
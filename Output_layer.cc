@@ -0,0 +1,208 @@
+#include <cassert>
+#include <cmath>
+#include <vector>
+#include <limits>
+#include <algorithm>
+#include <sstream>
+#include <stdexcept>
+
+#include "Types.hh"
+#include "include/Declare_functions.hh"
+#include "Parameters.hh"
+
+using namespace std;
+
+
+/* =============================================================================
+ * Routine computing the output layer (logits = inputs*W^T + b), the cross-entropy
+ * loss of the logits of each input row m wrt the target token targets[m], and
+ * the loss' gradients wrt W, b, and the inputs, without ever storing the full
+ * (nrows, nids_vocab) logits matrix. W is (nids_vocab, dim)-shaped, with row v
+ * the output embedding of token v, as in the (input) vocabulary embedding, so
+ * that the two can be one and the same matrix (weight tying).
+ * The vocabulary is split into shards of LOGITS_CHUNK_SIZE tokens, which are
+ * spread across the threads of the pool and go through twice:
+ *   1. the logits of each shard are computed, and the maximum and the sum of
+ *      exponentials (relative to that maximum) of each row within the shard
+ *      stored; these partial results are then reduced across the shards,
+ *      which gives the log-sum-exp of each row and so the loss;
+ *   2. the logits of each shard are recomputed and turned into the loss'
+ *      gradient wrt them (softmax probabilities minus 1 for the target token),
+ *      which gives the shard's elements of d_b and rows of d_W directly,
+ *      and its contribution to d_inputs. The shards are grouped into at most
+ *      LOGITS_NBLOCKS blocks of consecutive shards, each of which accumulates
+ *      the contributions of its shards, in order, into one (nrows, dim)
+ *      partial d_inputs; the partials are summed over the blocks at the end.
+ * Each thread only stores one (nrows, LOGITS_CHUNK_SIZE) shard of logits at a
+ * time. The blocks only depend on the vocabulary size, and partial results
+ * are always reduced in shard (block) order, so that results don't depend on
+ * the number of threads.
+ * Returns the loss summed over the rows; d_W, d_b, and d_inputs are
+ * overwritten.
+ * ============================================================================= */
+double logits_cross_entropy(const tensor_view_t<const double> &inputs,
+                            const vector<size_t>              &targets,
+                            const tensor_view_t<const double> &W,
+                            const tensor_view_t<const double> &b,
+                            const tensor_view_t<double>       &d_W,
+                            const tensor_view_t<double>       &d_b,
+                            const tensor_view_t<double>       &d_inputs,
+                            thread_pool_t                     &pool) {
+    const auto nrows      = inputs.rows();
+    const auto dim        = inputs.cols();
+    const auto nids_vocab = W.rows();
+
+    if (targets.size() != nrows or W.cols() != dim or b.size() != nids_vocab or
+        d_W.rows() != nids_vocab or d_W.cols() != dim or d_b.size() != nids_vocab or
+        d_inputs.rows() != nrows or d_inputs.cols() != dim) {
+        ostringstream exception_ss;
+        exception_ss << "logits_cross_entropy(): incompatible shapes: inputs is (" << nrows << ", " << dim
+                     << "), " << targets.size() << " targets, W is (" << nids_vocab << ", " << W.cols()
+                     << "), d_W is (" << d_W.rows() << ", " << d_W.cols() << "), d_inputs is ("
+                     << d_inputs.rows() << ", " << d_inputs.cols() << ")";
+        throw runtime_error(exception_ss.str());
+        return 0.;  // Not reached
+    }
+
+    for (const auto &target : targets) {
+        if (target >= nids_vocab) {
+            ostringstream exception_ss;
+            exception_ss << "logits_cross_entropy(): target token ID " << target
+                         << " out of range (vocabulary size: " << nids_vocab << ")";
+            throw runtime_error(exception_ss.str());
+            return 0.;  // Not reached
+        }
+    }
+
+    constexpr size_t shard_size = LOGITS_CHUNK_SIZE;
+    const     auto   nshards    = (nids_vocab + shard_size - 1)/shard_size;
+    const     auto   nblocks    = min(nshards, decltype(nshards){LOGITS_NBLOCKS});
+
+    // First shard of block k (block k is made of the shards [block_begin(k), block_begin(k + 1)))
+    const auto block_begin = [&](const size_t &k) { return k*nshards/nblocks; };
+
+    /* Partial results: maximum logit and sum of exponentials of each row per
+     * shard, and contribution to d_inputs per block (that of the first block
+     * goes directly into d_inputs)                                             */
+    tensor_t<double> shard_maxs(nshards, nrows), shard_sums(nshards, nrows);
+    tensor_t<double> block_d_inputs(nblocks - 1, nrows*dim);
+    vector<double>   target_logits(nrows), log_sum_exps(nrows);
+
+    // Logits of the shard [v0, v0 + nv), biases included, in this thread's buffer
+    const auto shard_logits = [&](const size_t &v0, const size_t &nv) {
+        thread_local vector<double> shard_buf;
+        shard_buf.resize(nrows*nv);
+
+        const tensor_view_t<double> logits(shard_buf.data(), nrows, nv, nv);
+
+        for (auto m = decltype(nrows){0}; m < nrows; ++m) {
+            copy(b.data() + v0, b.data() + v0 + nv, logits.row(m));
+        }
+
+        gemm(inputs, W.rows(v0, nv), logits, false, true, true);
+        return logits;
+    };
+
+
+    /* 1. Loss: log-sum-exp of the logits of each row minus the logit of its
+     *    target token                                                          */
+    pool.parallel_for(nshards, [&](const size_t &s_begin, const size_t &s_end, const size_t&) {
+        for (auto s = s_begin; s < s_end; ++s) {
+            const auto v0     = s*shard_size;
+            const auto nv     = min(shard_size, nids_vocab - v0);
+            const auto logits = shard_logits(v0, nv);
+
+            for (auto m = decltype(nrows){0}; m < nrows; ++m) {
+                const auto *logits_m = logits.row(m);
+                const auto  max_m    = *max_element(logits_m, logits_m + nv);
+                double      sum_m    = 0.;
+
+                for (auto v = decltype(nv){0}; v < nv; ++v) {
+                    sum_m += exp(logits_m[v] - max_m);
+                }
+
+                shard_maxs(s, m) = max_m;
+                shard_sums(s, m) = sum_m;
+
+                if (targets[m] >= v0 and targets[m] < v0 + nv) {
+                    target_logits[m] = logits_m[targets[m] - v0];
+                }
+            }
+        }
+    });
+
+    // Reduce the partial maxima and sums across shards, in shard order
+    double loss = 0.;
+
+    for (auto m = decltype(nrows){0}; m < nrows; ++m) {
+        auto max_m = -numeric_limits<double>::infinity();
+
+        for (auto s = decltype(nshards){0}; s < nshards; ++s) {
+            max_m = max(max_m, shard_maxs(s, m));
+        }
+
+        double sum_m = 0.;
+
+        for (auto s = decltype(nshards){0}; s < nshards; ++s) {
+            sum_m += shard_sums(s, m)*exp(shard_maxs(s, m) - max_m);
+        }
+
+        assert(sum_m > 0.);
+        log_sum_exps[m] = max_m + log(sum_m);
+        loss           += log_sum_exps[m] - target_logits[m];
+    }
+
+
+    /* 2. Gradients: d_logits = softmax(logits) - onehot(target), then
+     *      d_b      = sum of the rows of d_logits
+     *      d_W      = d_logits^T*inputs
+     *      d_inputs = d_logits*W                                               */
+    pool.parallel_for(nblocks, [&](const size_t &k_begin, const size_t &k_end, const size_t&) {
+        for (auto k = k_begin; k < k_end; ++k) {
+            const tensor_view_t<double> d_inputs_k = (k == 0) ? d_inputs :
+                tensor_view_t<double>(block_d_inputs.row(k - 1), nrows, dim);
+
+            for (auto s = block_begin(k); s < block_begin(k + 1); ++s) {
+                const auto v0       = s*shard_size;
+                const auto nv       = min(shard_size, nids_vocab - v0);
+                const auto d_logits = shard_logits(v0, nv);
+
+                fill(d_b.data() + v0, d_b.data() + v0 + nv, 0.);
+
+                for (auto m = decltype(nrows){0}; m < nrows; ++m) {
+                    auto *d_logits_m = d_logits.row(m);
+
+                    for (auto v = decltype(nv){0}; v < nv; ++v) {
+                        d_logits_m[v] = exp(d_logits_m[v] - log_sum_exps[m]);
+                    }
+
+                    if (targets[m] >= v0 and targets[m] < v0 + nv) {
+                        d_logits_m[targets[m] - v0] -= 1.;
+                    }
+
+                    for (auto v = decltype(nv){0}; v < nv; ++v) {
+                        d_b[v0 + v] += d_logits_m[v];
+                    }
+                }
+
+                gemm(d_logits, inputs,         d_W.rows(v0, nv), true,  false);
+                gemm(d_logits, W.rows(v0, nv), d_inputs_k,       false, false, s != block_begin(k));
+            }
+        }
+    });
+
+    // Sum the contributions to d_inputs across blocks, in block order
+    for (auto m = decltype(nrows){0}; m < nrows; ++m) {
+        auto *d_inputs_m = d_inputs.row(m);
+
+        for (auto k = decltype(nblocks){1}; k < nblocks; ++k) {
+            const auto *d_inputs_km = block_d_inputs.row(k - 1) + m*dim;
+
+            for (auto i = decltype(dim){0}; i < dim; ++i) {
+                d_inputs_m[i] += d_inputs_km[i];
+            }
+        }
+    }
+
+    return loss;
+}
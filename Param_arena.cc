@@ -0,0 +1,164 @@
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+#include <string>
+#include <sstream>
+#include <algorithm>
+#include <stdexcept>
+
+#include "Types.hh"
+
+using namespace std;
+
+
+/* ======================================
+ * Constructor of an empty, unallocated
+ * arena
+ * ====================================== */
+param_arena_t::param_arena_t()
+    : buffer_size(0),
+      nstates(0),
+      storage(nullptr, free) {}
+
+
+
+/* ===========================================================
+ * Method registering a parameter tensor, placed right after
+ * the previous one on the next cache-line boundary
+ * =========================================================== */
+void param_arena_t::add(const string &name,
+                        const size_t &nrows,
+                        const size_t &ncols,
+                        const double &init_value) {
+    if (allocated()) {
+        ostringstream exception_ss;
+        exception_ss << "param_arena_t::add(): can't add '" << name << "' to an allocated arena";
+        throw runtime_error(exception_ss.str());
+        return;  // Not reached
+    }
+
+    for (const auto &e : (this->entries)) {
+        if (e.name == name) {
+            ostringstream exception_ss;
+            exception_ss << "param_arena_t::add(): parameter '" << name << "' already registered";
+            throw runtime_error(exception_ss.str());
+            return;  // Not reached
+        }
+    }
+
+    constexpr auto align_elements = alignment/sizeof(double);
+    const     auto size           = nrows*ncols;
+
+    (this->entries).push_back({name, nrows, ncols, this->buffer_size, init_value});
+    (this->buffer_size) += ((size + align_elements - 1)/align_elements)*align_elements;
+    return;
+}
+
+
+
+/* ==============================================================
+ * Method allocating all the buffers at once and initializing
+ * the parameters, gradients, and optimizer states
+ * ============================================================== */
+void param_arena_t::allocate(const size_t &nstates) {
+    if (allocated()) {
+        throw runtime_error("param_arena_t::allocate(): arena already allocated");
+        return;  // Not reached
+    }
+
+    const auto nbytes = max(this->buffer_size, static_cast<size_t>(1))*(nstates + 2)*sizeof(double);
+    auto      *ptr    = static_cast<double*>(aligned_alloc(alignment, nbytes));
+
+    if (ptr == nullptr) {
+        ostringstream exception_ss;
+        exception_ss << "param_arena_t::allocate(): failed to allocate " << nbytes << " bytes";
+        throw runtime_error(exception_ss.str());
+        return;  // Not reached
+    }
+
+    (this->storage).reset(ptr);
+    this->nstates = nstates;
+
+    memset(ptr, 0, nbytes);
+
+    for (const auto &e : (this->entries)) {
+        fill(ptr + e.offset, ptr + e.offset + e.nrows*e.ncols, e.init_value);
+    }
+
+    return;
+}
+
+
+
+/* ======================================================
+ * Methods looking up a tensor by name in a given buffer
+ * ====================================================== */
+const param_arena_t::entry_t &param_arena_t::entry(const string &name) const {
+    for (const auto &e : (this->entries)) {
+        if (e.name == name) {
+            return e;
+        }
+    }
+
+    ostringstream exception_ss;
+    exception_ss << "param_arena_t: unknown parameter '" << name << "'";
+    throw out_of_range(exception_ss.str());
+}
+
+
+tensor_view_t<double> param_arena_t::view(const size_t &buffer,
+                                          const string &name) const {
+    if (not allocated()) {
+        throw runtime_error("param_arena_t: the arena must be allocated before accessing its tensors");
+    }
+
+    const auto &e = entry(name);
+    return tensor_view_t<double>((this->storage).get() + buffer*(this->buffer_size) + e.offset, e.nrows, e.ncols);
+}
+
+
+tensor_view_t<double> param_arena_t::state(const size_t &k,
+                                           const string &name) const {
+    if (k >= (this->nstates)) {
+        ostringstream exception_ss;
+        exception_ss << "param_arena_t::state(): state " << k << " out of range (number of states: "
+                     << (this->nstates) << ")";
+        throw out_of_range(exception_ss.str());
+    }
+
+    return view(k + 2, name);
+}
+
+
+
+/* ==================================================
+ * Methods zeroing the gradients and updating the
+ * parameters, each in one sweep over its buffer
+ * ================================================== */
+void param_arena_t::zero_grad() {
+    if (allocated()) {
+        memset(grads_data(), 0, (this->buffer_size)*sizeof(double));
+    }
+
+    return;
+}
+
+
+void param_arena_t::sgd_step(const double  &learning_rate,
+                             thread_pool_t &pool) {
+    if (not allocated()) {
+        throw runtime_error("param_arena_t::sgd_step(): the arena must be allocated first");
+        return;  // Not reached
+    }
+
+    double       *__restrict__ params = params_data();
+    const double *__restrict__ grads  = grads_data();
+
+    pool.parallel_for(this->buffer_size, [params, grads, &learning_rate](const size_t &begin, const size_t &end, const size_t&) {
+        for (auto idx = begin; idx < end; ++idx) {
+            params[idx] -= learning_rate*grads[idx];
+        }
+    });
+
+    return;
+}
@@ -33,11 +33,26 @@
 #define TOKENIZER BPE
 
 
+/* -----------------------------------------------------------------------------
+ * Binary file the trained tokenizer is saved to and loaded from, so that the
+ * tokenizer is only retrained when the training text or the tokenizer
+ * parameters change
+ * ----------------------------------------------------------------------------- */
+#define TOKENIZER_FILE "Tokenizer.bin"
+
+
 /* ------------------------------------------------------------------
  * Maximum vocabulary size for the byte-pair encoding (BPE) tokenizer
  * ------------------------------------------------------------------ */
 #define BPE_MAX_VOCAB_SIZE 200
 
+/* -----------------------------------------------------------------------------
+ * Maximum number of words whose token IDs are cached by the BPE tokenizer to
+ * speed up encoding (set to 0 to disable the cache)
+ * ----------------------------------------------------------------------------- */
+#define BPE_ENCODE_CACHE_SIZE 65536
+
+
 /* -------------------------------------------------------------------------
  * 'end-of-word' character to be added to each word during the BPE training
  * NOTE: '\x1f' (ASCII separator) is not printable with std::cout (printing it
@@ -64,6 +79,26 @@
 #define DIM 5
 
 
+/* -----------------------------------------------------------------------------
+ * Number of attention heads. Each head attends over DIM/NHEADS components of
+ * the queries, keys, and values, and the heads run in parallel. With more than
+ * one head, the concatenated head outputs go through an output projection.
+ * NOTE: DIM must be a multiple of NHEADS
+ * ----------------------------------------------------------------------------- */
+#define NHEADS 1
+
+
+/* -----------------------------------------------------------------------------
+ * Local (sliding-window) attention: each token only attends to the last
+ * ATTENTION_WINDOW tokens (itself included) and to the first ATTENTION_NGLOBAL
+ * tokens of the input, so that the cost of attention grows linearly with the
+ * input size
+ * NOTE: set ATTENTION_WINDOW to 0 for full causal attention
+ * ----------------------------------------------------------------------------- */
+#define ATTENTION_WINDOW  0
+#define ATTENTION_NGLOBAL 0
+
+
 /* ----------------------------------------
  * Number of training iterations ("epochs")
  * ---------------------------------------- */
@@ -115,6 +150,76 @@ constexpr inline double DROPOUT_PROB = 0.1;
 //#define CONTEXT_SIZE 5
 
 
+/* -----------------------------------------------------------------------------
+ * Number of threads used by the parallel parts of the code (e.g., the training
+ * of the BPE tokenizer). Results don't depend on the number of threads.
+ * NOTE: set to 0 to use one thread per hardware thread
+ * ----------------------------------------------------------------------------- */
+#define NTHREADS 0
+
+
+/* -----------------------------------------------------------------------------
+ * Tie the output (logits) weights to the vocabulary embedding, i.e., use the
+ * same matrix for both (as opposed to initializing the logits weights to a copy
+ * of the vocabulary embedding and training them separately)
+ * ----------------------------------------------------------------------------- */
+#define TIE_EMBEDDINGS false
+
+
+/* -----------------------------------------------------------------------------
+ * Number of vocabulary tokens whose logits are computed at a time when
+ * evaluating the output layer and the loss: each thread of the pool stores one
+ * (nids_input, LOGITS_CHUNK_SIZE) shard of logits at a time, on top of the
+ * LOGITS_NBLOCKS - 1 (nids_input, DIM) partial gradients wrt the inputs below
+ * and of a maximum and a sum of exponentials per shard and input token
+ * ----------------------------------------------------------------------------- */
+#define LOGITS_CHUNK_SIZE 1024
+
+
+/* -----------------------------------------------------------------------------
+ * Maximum number of blocks of consecutive logits shards whose contributions to
+ * the gradient wrt the inputs of the output layer are accumulated separately
+ * (and in parallel), which bounds both the parallelism of that gradient and
+ * the memory used for it. Results don't depend on the number of threads.
+ * ----------------------------------------------------------------------------- */
+#define LOGITS_NBLOCKS 16
+
+
+/* -----------------------------------------------------------------------------
+ * Use a fast, vectorizable approximation of tanh() in the GELU activation
+ * (its error is documented in include/Kernels_impl.hh) instead of the C library
+ * one
+ * ----------------------------------------------------------------------------- */
+#define GELU_FAST_TANH true
+
+
+/* -----------------------------------------------------------------------------
+ * Variant of the numeric kernels (softmax, layer normalization, GELU, matrix
+ * products) to use: "auto" (the best one supported by the CPU, checked at
+ * startup), "default" (baseline instruction set), "avx2", or "avx512". The
+ * LLM_KERNELS environment variable, if set, takes precedence.
+ * NOTE: all variants give the same results
+ * ----------------------------------------------------------------------------- */
+#define NUMERIC_KERNELS "auto"
+
+
+/* -----------------------------------------------------------------------------
+ * Tokenizer benchmark ('tokenizer_bench' executable) settings:
+ *   - number of untimed (warmup) and timed runs of each measurement
+ *   - largest maximum vocabulary size the BPE training is timed at (doubling
+ *     it from BPE_MAX_VOCAB_SIZE)
+ *   - size of the smallest and largest synthetic corpora, in units of the
+ *     training text size (growing by a factor 4 each time)
+ *   - seed used to generate the synthetic corpora
+ * ----------------------------------------------------------------------------- */
+#define BENCH_NWARMUP         1
+#define BENCH_NREPS           5
+#define BENCH_MAX_VOCAB_SIZE  1000
+#define BENCH_MIN_SCALE       4
+#define BENCH_MAX_SCALE       256
+#define BENCH_SEED            42
+
+
 /* ---------
  * Verbosity
  * --------- */
@@ -0,0 +1,147 @@
+#include <cstdint>
+#include <array>
+#include <string>
+#include <string_view>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+#include "Types.hh"
+
+using namespace std;
+
+
+/* ============================================================================
+ * Byte classification and lowercase tables. A byte either belongs to a word
+ * (letters and digits), is a punctuation character making up a single-byte
+ * word on its own, or is a separator to be skipped. This reproduces the regex
+ *   [a-zA-Z0-9]+|[.,;:!?'"()\[\]\{\}\/\\]
+ * previously used by the tokenizers.
+ * ============================================================================ */
+namespace {
+    enum byte_class_t : uint8_t { SEPARATOR = 0, ALNUM = 1, PUNCT = 2 };
+
+    constexpr auto build_byte_classes() {
+        array<uint8_t, 256> classes{};
+
+        for (int c = 0; c < 256; ++c) {
+            if ((c >= 'a' and c <= 'z') or (c >= 'A' and c <= 'Z') or (c >= '0' and c <= '9')) {
+                classes[c] = ALNUM;
+            }
+        }
+
+        for (const auto &c : string_view(R"(.,;:!?'"()[]{}/\)")) {
+            classes[static_cast<unsigned char>(c)] = PUNCT;
+        }
+
+        return classes;
+    }
+
+    constexpr auto build_lowercase() {
+        array<char, 256> lowercase{};
+
+        for (int c = 0; c < 256; ++c) {
+            lowercase[c] = static_cast<char>((c >= 'A' and c <= 'Z') ? c + ('a' - 'A') : c);
+        }
+
+        return lowercase;
+    }
+
+    constexpr auto byte_classes = build_byte_classes();
+    constexpr auto lowercase    = build_lowercase();
+}
+
+
+
+/* =============================================================================
+ * Method advancing the pre-tokenizer to the next word in the text. Returns
+ * false when the end of the text is reached.
+ * ============================================================================= */
+bool pretokenizer_t::next() {
+    const auto size = (this->text).size();
+    auto       pos  = (this->pos_end);
+
+    // Skip separators
+    while (pos < size and byte_classes[static_cast<unsigned char>((this->text)[pos])] == SEPARATOR) {
+        ++pos;
+    }
+
+    if (pos == size) {
+        (this->pos_begin) = (this->pos_end) = size;
+        (this->buffer).clear();
+        return false;
+    }
+
+    (this->pos_begin) = pos;
+    (this->buffer).clear();
+
+    const auto c = static_cast<unsigned char>((this->text)[pos]);
+
+    // Punctuation characters are single-character words
+    if (byte_classes[c] == PUNCT) {
+        (this->buffer).push_back(static_cast<char>(c));
+        (this->pos_end) = pos + 1;
+        return true;
+    }
+
+    #if defined(__SSE2__)
+    /* Fast path: classify and lowercase 16 bytes at a time as long as the
+     * whole block is made of letters and digits
+     * NOTE: a byte x lies in [lo, hi] iff (x - lo) <= (hi - lo) as unsigned
+     *       bytes, and a <= b iff max(a, b) == b as unsigned bytes             */
+    const auto in_range = [](const __m128i &x, const char &lo, const char &hi) {
+        const auto limit = _mm_set1_epi8(static_cast<char>(hi - lo));
+        const auto t     = _mm_sub_epi8(x, _mm_set1_epi8(lo));
+        return _mm_cmpeq_epi8(_mm_max_epu8(t, limit), limit);
+    };
+
+    while (pos + 16 <= size) {
+        const auto x     = _mm_loadu_si128(reinterpret_cast<const __m128i*>((this->text).data() + pos));
+        const auto upper = in_range(x, 'A', 'Z');
+        const auto alnum = _mm_or_si128(_mm_or_si128(upper, in_range(x, 'a', 'z')), in_range(x, '0', '9'));
+        const auto mask  = static_cast<unsigned int>(_mm_movemask_epi8(alnum));
+        const auto lower = _mm_add_epi8(x, _mm_and_si128(upper, _mm_set1_epi8(0x20)));
+
+        alignas(16) char block[16];
+        _mm_store_si128(reinterpret_cast<__m128i*>(block), lower);
+
+        if (mask == 0xffffu) {
+            (this->buffer).append(block, 16);
+            pos += 16;
+        } else {
+            // Number of leading alphanumeric bytes in the block
+            const auto nalnum = static_cast<size_t>(__builtin_ctz(~mask));
+            (this->buffer).append(block, nalnum);
+            (this->pos_end) = pos + nalnum;
+            return true;
+        }
+    }
+    #endif
+
+    // Scalar path (tail of the text, or no SIMD support)
+    while (pos < size and byte_classes[static_cast<unsigned char>((this->text)[pos])] == ALNUM) {
+        (this->buffer).push_back(lowercase[static_cast<unsigned char>((this->text)[pos])]);
+        ++pos;
+    }
+
+    (this->pos_end) = pos;
+    return true;
+}
+
+
+
+/* ==========================================================================
+ * Function returning the largest position at which the text can be cut
+ * without splitting a word, i.e., the position following the last byte which
+ * is not part of an alphanumeric run
+ * ========================================================================== */
+size_t pretokenizer_t::last_boundary(const string_view &text) {
+    for (auto pos = text.size(); pos > 0; --pos) {
+        if (byte_classes[static_cast<unsigned char>(text[pos-1])] != ALNUM) {
+            return pos;
+        }
+    }
+
+    return 0;
+}
@@ -1,42 +1,134 @@
+#include <cstdint>
 #include <vector>
-#include <random>
 #include <stdexcept>
 
+#include "Types.hh"
 #include "include/Declare_functions.hh"
 #include "Parameters.hh"
 
 using namespace std;
 
 
-/* ========================================================================
- * Routine applying dropout to the second input vector and adding it to the
- * first one
- * ======================================================================== */
-void skip_conn_dropout(vector<double> &vec,
-                       vector<double> &dropout_vec,
-                       uniform_real_distribution<double> &udist,
-                       mt19937 &gen) {
-    const auto dim = vec.size();
-
-    if (dropout_vec.size() != dim) {
-        throw runtime_error("skip_conn_dropout(): the sizes of the two vectors must match");
-        return;  // Not reached
-    }
+namespace {
 
+/* Apply dropout to row m of the second tensor and add it to row m of the first
+ * one, optionally storing the mask (1 for kept elements, 0 for dropped ones)  */
+void dropout_add_row(double         *vec_m,
+                     double         *dropout_vec_m,
+                     uint8_t        *mask_m,
+                     const size_t   &m,
+                     const size_t   &ncols,
+                     const philox_t &rng,
+                     const uint64_t &stream) {
     constexpr auto dropout_scale = 1./(1. - DROPOUT_PROB);
 
-    for (auto idx = decltype(dim){0}; idx < dim; ++idx) {
+    for (auto idx = decltype(ncols){0}; idx < ncols; ++idx) {
         if constexpr (DROPOUT_PROB > 0.) {
-            const auto x = udist(gen);
-            if (x < DROPOUT_PROB) {
-                dropout_vec.at(idx) = 0.;
-            } else {
-                dropout_vec.at(idx) *= dropout_scale;
+            const auto keep = (rng.uniform(stream, m*ncols + idx) >= DROPOUT_PROB);
+            dropout_vec_m[idx] = keep ? dropout_scale*dropout_vec_m[idx] : 0.;
+
+            if (mask_m != nullptr) {
+                mask_m[idx] = keep;
             }
+        } else if (mask_m != nullptr) {
+            mask_m[idx] = 1;
         }
 
-        vec.at(idx) += dropout_vec.at(idx);
+        vec_m[idx] += dropout_vec_m[idx];
+    }
+
+    return;
+}
+
+}  // namespace
+
+
+
+/* ========================================================================
+ * Routine applying dropout to the second input tensor and adding it to the
+ * first one. The dropout mask is drawn from the given stream of the
+ * counter-based generator, element (m, idx) using index m*ncols + idx, so
+ * that it doesn't depend on the order the elements are visited in and can
+ * be regenerated at any time.
+ * ======================================================================== */
+void skip_conn_dropout(const tensor_view_t<double> &vec,
+                       const tensor_view_t<double> &dropout_vec,
+                       const philox_t              &rng,
+                       const uint64_t              &stream) {
+    const auto nrows = vec.rows();
+    const auto ncols = vec.cols();
+
+    if (dropout_vec.rows() != nrows or dropout_vec.cols() != ncols) {
+        throw runtime_error("skip_conn_dropout(): the shapes of the two tensors must match");
+        return;  // Not reached
+    }
+
+    for (auto m = decltype(nrows){0}; m < nrows; ++m) {
+        dropout_add_row(vec.row(m), dropout_vec.row(m), nullptr, m, ncols, rng, stream);
+    }
+
+    return;
+}
+
+
+
+/* =============================================================================
+ * Routine fusing skip_conn_dropout() and layer_norm(): dropout is applied to
+ * the second input tensor, which is added to the first one, and the result is
+ * layer-normalized, one row at a time so that each row is only loaded from
+ * memory once. Rows are split across the threads of the pool; results don't
+ * depend on the number of threads. Optionally, the inverse standard deviation
+ * of each row (before scaling and shifting) and the dropout mask (1 byte per
+ * element, 1 for the kept ones) are stored for the backward pass.
+ * ============================================================================= */
+void skip_conn_dropout_layer_norm(const tensor_view_t<double>       &vec,
+                                  const tensor_view_t<double>       &dropout_vec,
+                                  const philox_t                    &rng,
+                                  const uint64_t                    &stream,
+                                  const tensor_view_t<const double> &scale,
+                                  const tensor_view_t<const double> &shift,
+                                  thread_pool_t                     &pool,
+                                  const tensor_view_t<double>       *sigmas_inv,
+                                  const tensor_view_t<uint8_t>      *mask) {
+    const auto nrows = vec.rows();
+    const auto ncols = vec.cols();
+
+    if (dropout_vec.rows() != nrows or dropout_vec.cols() != ncols) {
+        throw runtime_error("skip_conn_dropout_layer_norm(): the shapes of the two tensors must match");
+        return;  // Not reached
+    }
+
+    if (scale.size() != ncols or shift.size() != ncols or not scale.contiguous() or not shift.contiguous()) {
+        throw runtime_error("skip_conn_dropout_layer_norm(): scale and shift must be contiguous and have as many elements as each row of the tensors");
+        return;  // Not reached
+    }
+
+    if (sigmas_inv != nullptr and sigmas_inv->size() != nrows) {
+        throw runtime_error("skip_conn_dropout_layer_norm(): sigmas_inv->size() must equal the number of rows of the tensors");
+        return;  // Not reached
+    }
+
+    if (mask != nullptr and (mask->rows() != nrows or mask->cols() != ncols)) {
+        throw runtime_error("skip_conn_dropout_layer_norm(): the mask must be shaped like the tensors");
+        return;  // Not reached
     }
 
+    const auto &layer_norm_kernel = kernels().layer_norm;
+
+    pool.parallel_for(nrows, [&](const size_t &m_begin, const size_t &m_end, const size_t&) {
+        for (auto m = m_begin; m < m_end; ++m) {
+            auto *vec_m = vec.row(m);
+
+            dropout_add_row(vec_m, dropout_vec.row(m), (mask != nullptr) ? mask->row(m) : nullptr,
+                            m, ncols, rng, stream);
+
+            const auto sigma_inv = layer_norm_kernel(vec_m, ncols, scale.data(), shift.data());
+
+            if (sigmas_inv != nullptr) {
+                (*sigmas_inv)[m] = sigma_inv;
+            }
+        }
+    });
+
     return;
 }
@@ -1,39 +1,23 @@
-#include <cassert>
-#include <cmath>
 #include <vector>
-#include <limits>
 
+#include "Types.hh"
 #include "include/Declare_functions.hh"
 
 using namespace std;
 
 
 /* ===========================================================
- * Routine applying a softmax normalization to an input vector
+ * Routine applying a softmax normalization to each row of an
+ * input tensor
  * =========================================================== */
-void softmax(vector<double> &vec) {
-    auto max = -numeric_limits<double>::infinity();
+void softmax(const tensor_view_t<double> &vecs) {
+    const auto nrows = vecs.rows();
+    const auto ncols = vecs.cols();
 
-    // Find the largest element
-    for (const auto &el : vec) {
-        if (el > max) {
-            max = el;
-        }
-    }
-
-    assert(isfinite(max));
-    double sum_exp = 0.; 
-
-    for (auto &el : vec) {
-        const auto exp_att = exp(el - max);
-        el       = exp_att;
-        sum_exp += exp_att;
-    }
-
-    assert(sum_exp > 0.);
+    const auto &kernel = kernels().softmax;
 
-    for (auto &el : vec) {
-        el /= sum_exp;
+    for (auto m = decltype(nrows){0}; m < nrows; ++m) {
+        kernel(vecs.row(m), ncols);
     }
 
     return;
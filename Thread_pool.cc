@@ -0,0 +1,165 @@
+#include <algorithm>
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <exception>
+
+#include "Types.hh"
+
+using namespace std;
+
+
+/* =========================================================
+ * Constructor spawning the worker threads and destructor
+ * joining them
+ * ========================================================= */
+thread_pool_t::thread_pool_t(const size_t &nthreads)
+    : task(nullptr), generation(0), npending(0), stop(false) {
+    auto nthreads_tot = nthreads;
+
+    if (nthreads_tot == 0) {
+        // NOTE: hardware_concurrency() may return 0 if it can't tell
+        nthreads_tot = max(thread::hardware_concurrency(), 1u);
+    }
+
+    (this->workers).reserve(nthreads_tot - 1);
+
+    for (auto thread_id = decltype(nthreads_tot){1}; thread_id < nthreads_tot; ++thread_id) {
+        (this->workers).emplace_back(&thread_pool_t::worker_loop, this, thread_id);
+    }
+}
+
+
+thread_pool_t::~thread_pool_t() {
+    {
+        lock_guard<mutex> lock(this->mtx);
+        (this->stop) = true;
+    }
+
+    (this->cv_start).notify_all();
+
+    for (auto &worker : (this->workers)) {
+        worker.join();
+    }
+}
+
+
+
+/* ===========================================================
+ * Loop run by each worker thread: wait for a new task, run it,
+ * and notify the calling thread when done
+ * =========================================================== */
+void thread_pool_t::worker_loop(const size_t thread_id) {
+    size_t last_generation = 0;
+
+    while (true) {
+        const function<void(const size_t&)> *current_task;
+
+        {
+            unique_lock<mutex> lock(this->mtx);
+            (this->cv_start).wait(lock, [&]() {
+                return (this->stop) or (this->generation) != last_generation;
+            });
+
+            if (this->stop) {
+                return;
+            }
+
+            last_generation = (this->generation);
+            current_task    = (this->task);
+        }
+
+        exception_ptr thread_exception;
+
+        try {
+            (*current_task)(thread_id);
+        } catch (...) {
+            thread_exception = current_exception();
+        }
+
+        {
+            lock_guard<mutex> lock(this->mtx);
+
+            if (thread_exception and not (this->exception)) {
+                (this->exception) = thread_exception;
+            }
+
+            if (--(this->npending) == 0) {
+                (this->cv_done).notify_one();
+            }
+        }
+    }
+}
+
+
+
+/* =========================================================
+ * Method running a task on all threads and waiting for them
+ * ========================================================= */
+void thread_pool_t::run(const function<void(const size_t&)> &task) {
+    if ((this->workers).empty()) {
+        task(0);
+        return;
+    }
+
+    {
+        lock_guard<mutex> lock(this->mtx);
+        (this->task)      = &task;
+        (this->npending)  = (this->workers).size();
+        (this->exception) = nullptr;
+        ++(this->generation);
+    }
+
+    (this->cv_start).notify_all();
+
+    // The calling thread is thread 0
+    exception_ptr main_exception;
+
+    try {
+        task(0);
+    } catch (...) {
+        main_exception = current_exception();
+    }
+
+    {
+        unique_lock<mutex> lock(this->mtx);
+        (this->cv_done).wait(lock, [&]() { return (this->npending) == 0; });
+        (this->task) = nullptr;
+    }
+
+    if (main_exception) {
+        rethrow_exception(main_exception);
+    }
+
+    if (this->exception) {
+        rethrow_exception(this->exception);
+    }
+
+    return;
+}
+
+
+
+/* ===============================================================
+ * Method splitting a range of indices into one contiguous chunk
+ * per thread and processing the chunks in parallel
+ * =============================================================== */
+void thread_pool_t::parallel_for(const size_t &n,
+                                 const function<void(const size_t&, const size_t&, const size_t&)> &func) {
+    const auto nthreads = size();
+    const auto chunk    = n/nthreads;
+    const auto rem      = n%nthreads;
+
+    run([&](const size_t &thread_id) {
+        const auto begin = thread_id*chunk + min(thread_id, rem);
+        const auto end   = begin + chunk + ((thread_id < rem) ? 1 : 0);
+
+        if (begin < end) {
+            func(begin, end, thread_id);
+        }
+    });
+
+    return;
+}
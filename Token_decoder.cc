@@ -0,0 +1,82 @@
+#include <vector>
+#include <string>
+#include <string_view>
+#include <ostream>
+#include <sstream>
+#include <stdexcept>
+
+#include "Types.hh"
+
+using namespace std;
+
+
+/* ============================================
+ * Constructor and destructor (flushing to the
+ * sink whatever is left in the buffer)
+ * ============================================ */
+token_decoder_t::token_decoder_t(const flat_vocab_t &vocab,
+                                 const string_view  &separator,
+                                 ostream            *sink,
+                                 const size_t       &flush_size)
+    : vocab(vocab),
+      separator(separator),
+      sink(sink),
+      flush_size(flush_size) {
+    if (sink != nullptr) {
+        (this->buffer).reserve(flush_size + 64);
+    }
+}
+
+
+token_decoder_t::~token_decoder_t() {
+    flush();
+}
+
+
+
+/* ==========================================================
+ * Methods decoding token IDs into the buffer, writing it to
+ * the sink once it is large enough
+ * ========================================================== */
+void token_decoder_t::push(const size_t &id) {
+    if (id >= (this->vocab).size()) {
+        ostringstream exception_ss;
+        exception_ss << "token_decoder_t::push(): unknown token ID " << id
+                     << " (vocabulary size: " << (this->vocab).size() << ")";
+        throw runtime_error(exception_ss.str());
+        return;  // Not reached
+    }
+
+    (this->buffer).append((this->vocab).token(id));
+    (this->buffer).append(this->separator);
+
+    if ((this->sink) != nullptr and (this->buffer).size() >= (this->flush_size)) {
+        flush();
+    }
+
+    return;
+}
+
+
+void token_decoder_t::push(const vector<size_t> &ids) {
+    for (const auto &id : ids) {
+        push(id);
+    }
+
+    return;
+}
+
+
+
+/* =============================================
+ * Method writing the buffer to the sink (if any)
+ * ============================================= */
+void token_decoder_t::flush() {
+    if ((this->sink) == nullptr or (this->buffer).empty()) {
+        return;
+    }
+
+    (this->sink)->write((this->buffer).data(), (this->buffer).size());
+    (this->buffer).clear();
+    return;
+}
@@ -0,0 +1,251 @@
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <vector>
+#include <string>
+#include <string_view>
+#include <fstream>
+#include <istream>
+#include <sstream>
+#include <functional>
+#include <stdexcept>
+
+#include "Types.hh"
+#include "include/Declare_functions.hh"
+
+using namespace std;
+
+
+/* ==========================================================================
+ * Constructor opening a token-ID shard file for writing. A placeholder header
+ * is written right away and overwritten with the final one by close().
+ * ========================================================================== */
+token_shard_writer_t::token_shard_writer_t(const string &filename,
+                                           const size_t &vocab_size)
+    : outfile(filename, ofstream::binary | ofstream::trunc),
+      filename(filename),
+      header{},
+      closed(false) {
+    if (not (this->outfile)) {
+        ostringstream err_ss;
+        err_ss << "token_shard_writer_t(): unable to open file '" << filename << "' for writing";
+        throw runtime_error(err_ss.str());
+    }
+
+    memcpy((this->header).magic, magic, sizeof(magic));
+    (this->header).version    = version;
+    (this->header).id_size    = (vocab_size <= (size_t{1} << 16)) ? sizeof(uint16_t) : sizeof(uint32_t);
+    (this->header).vocab_size = vocab_size;
+    (this->header).ntokens    = 0;
+
+    if (vocab_size > (size_t{1} << 32)) {
+        throw runtime_error("token_shard_writer_t(): vocabulary too large for 32-bit token IDs");
+    }
+
+    (this->outfile).write(reinterpret_cast<const char*>(&(this->header)), sizeof(this->header));
+}
+
+
+token_shard_writer_t::~token_shard_writer_t() {
+    // NOTE: destructors must not throw
+    try {
+        close();
+    } catch (...) {}
+}
+
+
+
+/* ===========================================
+ * Method appending token IDs to a shard file
+ * =========================================== */
+void token_shard_writer_t::append(const vector<size_t> &ids) {
+    if (this->closed) {
+        throw runtime_error("token_shard_writer_t::append(): shard already closed");
+    }
+
+    const auto nids    = ids.size();
+    const auto id_size = (this->header).id_size;
+    const auto vocab_size = (this->header).vocab_size;
+
+    (this->buffer).resize(nids*id_size);
+
+    for (auto i = decltype(nids){0}; i < nids; ++i) {
+        const auto id = ids[i];
+
+        if (id >= vocab_size) {
+            ostringstream err_ss;
+            err_ss << "token_shard_writer_t::append(): token ID " << id
+                   << " out of range (vocabulary size: " << vocab_size << ")";
+            throw runtime_error(err_ss.str());
+        }
+
+        if (id_size == sizeof(uint16_t)) {
+            const auto id16 = static_cast<uint16_t>(id);
+            memcpy((this->buffer).data() + i*id_size, &id16, id_size);
+        } else {
+            const auto id32 = static_cast<uint32_t>(id);
+            memcpy((this->buffer).data() + i*id_size, &id32, id_size);
+        }
+    }
+
+    (this->outfile).write((this->buffer).data(), (this->buffer).size());
+    (this->header).ntokens += nids;
+
+    if (not (this->outfile)) {
+        ostringstream err_ss;
+        err_ss << "token_shard_writer_t::append(): failed to write to file '" << (this->filename) << "'";
+        throw runtime_error(err_ss.str());
+    }
+
+    return;
+}
+
+
+
+/* ==================================================================
+ * Method writing the final header (with the total number of tokens)
+ * and closing the shard file
+ * ================================================================== */
+size_t token_shard_writer_t::close() {
+    if (not (this->closed)) {
+        (this->closed) = true;
+        (this->outfile).seekp(0);
+        (this->outfile).write(reinterpret_cast<const char*>(&(this->header)), sizeof(this->header));
+        (this->outfile).close();
+
+        if (not (this->outfile)) {
+            ostringstream err_ss;
+            err_ss << "token_shard_writer_t::close(): failed to write to file '" << (this->filename) << "'";
+            throw runtime_error(err_ss.str());
+        }
+    }
+
+    return (this->header).ntokens;
+}
+
+
+
+/* ======================================================================
+ * Constructor mapping a token-ID shard file into memory and validating it
+ * ====================================================================== */
+token_shard_t::token_shard_t(const string &filename)
+    : file(filename) {
+    const auto fail = [&filename](const string &reason) {
+        ostringstream err_ss;
+        err_ss << "token_shard_t(): invalid token shard file '" << filename << "': " << reason;
+        throw runtime_error(err_ss.str());
+    };
+
+    if ((this->file).size() < sizeof(token_shard_header_t)) {
+        fail("file too small");
+    }
+
+    (this->header) = reinterpret_cast<const token_shard_header_t*>((this->file).data());
+    (this->ids)    = (this->file).data() + sizeof(token_shard_header_t);
+
+    if (memcmp(header->magic, token_shard_writer_t::magic, sizeof(token_shard_writer_t::magic)) != 0) {
+        fail("wrong magic number");
+    }
+
+    if (header->version != token_shard_writer_t::version) {
+        fail("unsupported version");
+    }
+
+    if (header->id_size != sizeof(uint16_t) and header->id_size != sizeof(uint32_t)) {
+        fail("unsupported token ID size");
+    }
+
+    if ((this->file).size() - sizeof(token_shard_header_t) != header->ntokens*header->id_size) {
+        fail("file size inconsistent with the number of tokens");
+    }
+}
+
+
+
+/* ============================================================================
+ * Functions encoding a stream or a (possibly memory-mapped) text into a token
+ * ID shard file chunk by chunk, so that only one chunk of text and the
+ * corresponding token IDs are in memory at any given time. Chunks are cut at
+ * word boundaries, so that the result is the same as encoding the whole text
+ * at once. If a chunk contains no word boundary (i.e., a single word is longer
+ * than the chunk), the chunk is extended until a boundary is found.
+ * ============================================================================ */
+size_t encode_to_shard(istream      &in,
+                       const string &filename,
+                       const size_t &vocab_size,
+                       const size_t &chunk_size,
+                       const function<void(const string_view&, vector<size_t>&)> &encode) {
+    if (chunk_size == 0) {
+        throw runtime_error("encode_to_shard(): the chunk size must be positive");
+    }
+
+    token_shard_writer_t writer(filename, vocab_size);
+    string         buffer;  // Text not encoded yet
+    vector<size_t> ids;
+    bool           eof = false;
+
+    while (not eof) {
+        const auto size_old = buffer.size();
+        buffer.resize(size_old + chunk_size);
+        in.read(&buffer[size_old], chunk_size);
+
+        const auto nread = static_cast<size_t>(in.gcount());
+        buffer.resize(size_old + nread);
+        eof = (nread < chunk_size);
+
+        const auto cut = eof ? buffer.size() : pretokenizer_t::last_boundary(buffer);
+
+        if (cut > 0) {
+            ids.clear();
+            encode(string_view(buffer).substr(0, cut), ids);
+            writer.append(ids);
+            buffer.erase(0, cut);
+        }
+    }
+
+    if (in.bad()) {
+        throw runtime_error("encode_to_shard(): error reading from the input stream");
+    }
+
+    return writer.close();
+}
+
+
+size_t encode_to_shard(const string_view &text,
+                       const string      &filename,
+                       const size_t      &vocab_size,
+                       const size_t      &chunk_size,
+                       const function<void(const string_view&, vector<size_t>&)> &encode) {
+    if (chunk_size == 0) {
+        throw runtime_error("encode_to_shard(): the chunk size must be positive");
+    }
+
+    token_shard_writer_t writer(filename, vocab_size);
+    vector<size_t> ids;
+
+    const auto size = text.size();
+    size_t     pos  = 0;
+
+    while (pos < size) {
+        auto len = min(chunk_size, size - pos);
+        auto cut = len;
+
+        while (pos + len < size) {
+            cut = pretokenizer_t::last_boundary(text.substr(pos, len));
+
+            if (cut > 0) {
+                break;
+            }
+
+            len = min(2*len, size - pos);
+            cut = len;
+        }
+
+        ids.clear();
+        encode(text.substr(pos, cut), ids);
+        writer.append(ids);
+        pos += cut;
+    }
+
+    return writer.close();
+}
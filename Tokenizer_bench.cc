@@ -0,0 +1,301 @@
+#include <cstdint>
+#include <array>
+#include <vector>
+#include <string>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <random>
+#include <algorithm>
+#include <numeric>
+#include <chrono>
+#include <thread>
+#include <functional>
+#include <stdexcept>
+
+#include "Check_parameters.hh"
+#include "Types.hh"
+#include "include/Declare_functions.hh"
+
+#include "Parameters.hh"
+
+using namespace std;
+
+
+/* -----------------------------------------------------------------------------
+ * Microbenchmarks of the tokenizers: BPE training time vs. vocabulary size, and
+ * encode and decode throughput of the word and BPE tokenizers on the training
+ * text and on synthetic corpora BENCH_MIN_SCALE, 4*BENCH_MIN_SCALE, ... times
+ * larger than it. Each measurement is repeated BENCH_NREPS times after
+ * BENCH_NWARMUP untimed runs. Usage:
+ *   tokenizer_bench [csv|json] [output_file]
+ * Results go to 'output_file' if given, to standard output otherwise; progress
+ * messages always go to standard error.
+ * ----------------------------------------------------------------------------- */
+
+namespace {
+
+struct bench_result_t {
+    string benchmark;   // "train", "encode", or "decode"
+    string tokenizer;   // "word", "bpe", or "bpe_cached"
+    string corpus;
+    size_t corpus_bytes;
+    size_t ntokens;
+    size_t vocab_size;
+    double time_min;
+    double time_median;
+    double time_mean;
+};
+
+
+
+/* ==========================================================================
+ * Run 'func' BENCH_NWARMUP times untimed and then BENCH_NREPS times timed,
+ * returning the minimum, median, and mean wall-clock times in seconds
+ * ========================================================================== */
+array<double, 3> time_runs(const function<void()> &func) {
+    for (auto i = decltype(BENCH_NWARMUP){0}; i < BENCH_NWARMUP; ++i) {
+        func();
+    }
+
+    vector<double> times(BENCH_NREPS);
+
+    for (auto &t : times) {
+        const auto start = chrono::steady_clock::now();
+        func();
+        t = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    }
+
+    sort(times.begin(), times.end());
+
+    const auto nreps  = times.size();
+    const auto median = (nreps % 2 == 1) ? times.at(nreps/2)
+                                         : 0.5*(times.at(nreps/2 - 1) + times.at(nreps/2));
+
+    return {times.front(), median, accumulate(times.begin(), times.end(), 0.)/nreps};
+}
+
+
+
+/* ==========================================================================
+ * Build a synthetic corpus of (at least) 'nbytes' bytes by drawing words
+ * from the given text at random, so that the word frequencies follow those
+ * of the text and every word is in the tokenizers' vocabularies
+ * ========================================================================== */
+string synthetic_corpus(const string &text,
+                        const size_t &nbytes,
+                        mt19937      &gen) {
+    vector<string> words;
+    pretokenizer_t pretokenizer(text);
+
+    while (pretokenizer.next()) {
+        words.emplace_back(pretokenizer.span());
+    }
+
+    if (words.empty()) {
+        throw runtime_error("synthetic_corpus(): need at least one word in the text");
+        return string();  // Not reached
+    }
+
+    uniform_int_distribution<size_t> dist(0, words.size() - 1);
+    string corpus;
+    corpus.reserve(nbytes + 64);
+
+    while (corpus.size() < nbytes) {
+        corpus.append(words.at(dist(gen)));
+        corpus += ' ';
+    }
+
+    return corpus;
+}
+
+
+
+/* ==========================================================================
+ * Benchmark the encode() and decode() methods of a tokenizer on a corpus
+ * ========================================================================== */
+template <typename tokenizer_t>
+void bench_encode_decode(const tokenizer_t       &tokenizer,
+                         const string            &name,
+                         const string            &corpus_name,
+                         const string            &corpus,
+                         vector<bench_result_t>  &results) {
+    const auto nids_vocab = tokenizer.vocab.size();
+    vector<size_t> ids;
+    string         text;
+
+    const auto t_encode = time_runs([&]() {
+        ids.clear();
+        tokenizer.encode(corpus, ids);
+    });
+
+    results.push_back({"encode", name, corpus_name, corpus.size(), ids.size(), nids_vocab,
+                       t_encode.at(0), t_encode.at(1), t_encode.at(2)});
+
+    const auto t_decode = time_runs([&]() {
+        text.clear();
+        tokenizer.decode(ids, text);
+    });
+
+    results.push_back({"decode", name, corpus_name, text.size(), ids.size(), nids_vocab,
+                       t_decode.at(0), t_decode.at(1), t_decode.at(2)});
+
+    cerr << "INFO: " << name << " tokenizer, corpus '" << corpus_name << "' (" << corpus.size()
+         << " bytes): encode " << t_encode.at(1) << " s, decode " << t_decode.at(1) << " s" << endl;
+
+    return;
+}
+
+
+
+/* ==========================================================================
+ * Write the results in CSV or JSON format. Throughputs are computed from the
+ * median times.
+ * ========================================================================== */
+void write_results(const vector<bench_result_t> &results,
+                   const string                 &format,
+                   ostream                      &out) {
+    const auto mb_per_s     = [](const bench_result_t &r) { return r.corpus_bytes/(1.e+06*r.time_median); };
+    const auto tokens_per_s = [](const bench_result_t &r) { return r.ntokens/r.time_median; };
+
+    if (format == "csv") {
+        out << "benchmark,tokenizer,corpus,corpus_bytes,ntokens,vocab_size,nreps,time_min_s,time_median_s,time_mean_s,MB_per_s,tokens_per_s" << endl;
+
+        for (const auto &r : results) {
+            out << r.benchmark << "," << r.tokenizer << "," << r.corpus << "," << r.corpus_bytes << ","
+                << r.ntokens << "," << r.vocab_size << "," << BENCH_NREPS << ","
+                << r.time_min << "," << r.time_median << "," << r.time_mean << ","
+                << mb_per_s(r) << "," << tokens_per_s(r) << endl;
+        }
+    }
+
+    else if (format == "json") {
+        out << "{" << endl
+            << "  \"nwarmup\": " << BENCH_NWARMUP << "," << endl
+            << "  \"nreps\": " << BENCH_NREPS << "," << endl
+            << "  \"hardware_threads\": " << thread::hardware_concurrency() << "," << endl
+            << "  \"results\": [" << endl;
+
+        const auto nresults = results.size();
+
+        for (auto i = decltype(nresults){0}; i < nresults; ++i) {
+            const auto &r = results.at(i);
+            out << "    {\"benchmark\": \"" << r.benchmark << "\", \"tokenizer\": \"" << r.tokenizer
+                << "\", \"corpus\": \"" << r.corpus << "\", \"corpus_bytes\": " << r.corpus_bytes
+                << ", \"ntokens\": " << r.ntokens << ", \"vocab_size\": " << r.vocab_size
+                << ", \"time_min_s\": " << r.time_min << ", \"time_median_s\": " << r.time_median
+                << ", \"time_mean_s\": " << r.time_mean << ", \"MB_per_s\": " << mb_per_s(r)
+                << ", \"tokens_per_s\": " << tokens_per_s(r) << "}"
+                << ((i + 1 < nresults) ? "," : "") << endl;
+        }
+
+        out << "  ]" << endl
+            << "}" << endl;
+    }
+
+    else {
+        ostringstream err_ss;
+        err_ss << "write_results(): unknown output format '" << format << "' (choices: csv, json)";
+        throw runtime_error(err_ss.str());
+    }
+
+    return;
+}
+
+}  // namespace
+
+
+
+int main(int argc, char *argv[]) {
+    const string format((argc > 1) ? argv[1] : "csv");
+
+    if (format != "csv" and format != "json") {
+        cerr << "Usage: " << argv[0] << " [csv|json] [output_file]" << endl;
+        return 1;
+    }
+
+    ifstream infile(INFILE_TRAINING, ifstream::in);
+
+    if (not infile.is_open()) {
+        ostringstream err_ss;
+        err_ss << "Unable to read from file '" << INFILE_TRAINING << "'";
+        throw runtime_error(err_ss.str());
+        return 1;  // Not reached
+    }
+
+    ostringstream training_text_ss;
+    training_text_ss << infile.rdbuf();
+    const auto   &training_text(training_text_ss.str());
+    const string  eow(BPE_END_OF_WORD);
+
+    vector<bench_result_t> results;
+
+
+    /* ----------------------------------------------------------------------
+     * 1. BPE training time vs. maximum vocabulary size (doubling it from
+     *    BPE_MAX_VOCAB_SIZE up to BENCH_MAX_VOCAB_SIZE)
+     * ----------------------------------------------------------------------    */
+    for (size_t max_vocab_size = BPE_MAX_VOCAB_SIZE; max_vocab_size <= BENCH_MAX_VOCAB_SIZE; max_vocab_size *= 2) {
+        size_t nids_vocab = 0;
+
+        const auto t_train = time_runs([&]() {
+            const bpe_tokenizer_t tokenizer(training_text, eow, max_vocab_size, NTHREADS);
+            nids_vocab = tokenizer.vocab.size();
+        });
+
+        results.push_back({"train", "bpe", "training_text", training_text.size(), 0, nids_vocab,
+                           t_train.at(0), t_train.at(1), t_train.at(2)});
+
+        cerr << "INFO: BPE training up to vocabulary size " << max_vocab_size
+             << ": " << t_train.at(1) << " s" << endl;
+    }
+
+
+    /* ----------------------------------------------------------------------
+     * 2. Encode and decode throughput on the training text and on synthetic
+     *    corpora of increasing size
+     * ----------------------------------------------------------------------    */
+    const word_tokenizer_t word_tokenizer(training_text);
+    const bpe_tokenizer_t  bpe_tokenizer(training_text, eow, BPE_MAX_VOCAB_SIZE, NTHREADS);
+
+    bpe_tokenizer_t bpe_tokenizer_cached(training_text, eow, BPE_MAX_VOCAB_SIZE, NTHREADS);
+    bpe_tokenizer_cached.enable_cache(BPE_ENCODE_CACHE_SIZE);
+
+    vector<pair<string, string>> corpora;
+    corpora.emplace_back("training_text", training_text);
+
+    mt19937 gen(BENCH_SEED);
+
+    for (size_t scale = BENCH_MIN_SCALE; scale <= BENCH_MAX_SCALE; scale *= 4) {
+        corpora.emplace_back("synthetic_x" + to_string(scale),
+                             synthetic_corpus(training_text, scale*training_text.size(), gen));
+    }
+
+    for (const auto &[corpus_name, corpus] : corpora) {
+        bench_encode_decode(word_tokenizer,       "word",       corpus_name, corpus, results);
+        bench_encode_decode(bpe_tokenizer,        "bpe",        corpus_name, corpus, results);
+        bench_encode_decode(bpe_tokenizer_cached, "bpe_cached", corpus_name, corpus, results);
+    }
+
+
+    /* ----------------
+     * 3. Write results
+     * ----------------    */
+    if (argc > 2) {
+        ofstream outfile(argv[2]);
+
+        if (not outfile.is_open()) {
+            ostringstream err_ss;
+            err_ss << "Unable to write to file '" << argv[2] << "'";
+            throw runtime_error(err_ss.str());
+            return 1;  // Not reached
+        }
+
+        write_results(results, format, outfile);
+        cerr << "INFO: results written to '" << argv[2] << "'" << endl;
+    } else {
+        write_results(results, format, cout);
+    }
+
+    return 0;
+}
@@ -0,0 +1,255 @@
+#include <cstdint>
+#include <cstring>
+#include <cstdio>
+#include <array>
+#include <vector>
+#include <string>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "Types.hh"
+#include "include/Declare_functions.hh"
+
+using namespace std;
+
+
+/* ===========================================================================
+ * 64-bit FNV-1a hash of a sequence of bytes, used to checksum the tokenizer
+ * files and to fingerprint the training setup. Passing the hash of a previous
+ * sequence as the seed hashes the concatenation of the two sequences.
+ * =========================================================================== */
+uint64_t fnv1a_64(const void     *data,
+                  const size_t   &size,
+                  const uint64_t &seed) {
+    constexpr uint64_t prime = 0x100000001b3ULL;
+
+    const auto bytes = static_cast<const unsigned char*>(data);
+    auto       hash  = seed;
+
+    for (auto i = decltype(size){0}; i < size; ++i) {
+        hash ^= bytes[i];
+        hash *= prime;
+    }
+
+    return hash;
+}
+
+
+
+/* ======================================================
+ * Constructor mapping a whole file into memory read-only
+ * ====================================================== */
+mapped_file_t::mapped_file_t(const string &filename)
+    : ptr(nullptr), len(0) {
+    const auto fd = open(filename.c_str(), O_RDONLY);
+
+    if (fd < 0) {
+        ostringstream err_ss;
+        err_ss << "mapped_file_t(): unable to open file '" << filename << "'";
+        throw runtime_error(err_ss.str());
+    }
+
+    struct stat st;
+
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        ostringstream err_ss;
+        err_ss << "mapped_file_t(): unable to stat file '" << filename << "'";
+        throw runtime_error(err_ss.str());
+    }
+
+    (this->len) = static_cast<size_t>(st.st_size);
+
+    // NOTE: mmap() fails on empty files
+    if ((this->len) > 0) {
+        const auto addr = mmap(nullptr, (this->len), PROT_READ, MAP_SHARED, fd, 0);
+
+        if (addr == MAP_FAILED) {
+            close(fd);
+            ostringstream err_ss;
+            err_ss << "mapped_file_t(): unable to map file '" << filename << "' into memory";
+            throw runtime_error(err_ss.str());
+        }
+
+        (this->ptr) = static_cast<const char*>(addr);
+    }
+
+    // The mapping stays valid after the file descriptor is closed
+    close(fd);
+}
+
+
+mapped_file_t::~mapped_file_t() {
+    if ((this->ptr) != nullptr) {
+        munmap(const_cast<char*>(this->ptr), (this->len));
+    }
+}
+
+
+
+/* ============================================================================
+ * Constructor mapping a tokenizer file into memory and validating its content
+ * ============================================================================ */
+tokenizer_file_t::tokenizer_file_t(const string   &filename,
+                                   const uint32_t &kind,
+                                   const uint64_t &fingerprint)
+    : file(filename) {
+    const auto fail = [&filename](const string &reason) {
+        ostringstream err_ss;
+        err_ss << "tokenizer_file_t(): invalid tokenizer file '" << filename << "': " << reason;
+        throw runtime_error(err_ss.str());
+    };
+
+    const auto file_size = (this->file).size();
+
+    if (file_size < sizeof(tokenizer_file_header_t)) {
+        fail("file too small");
+    }
+
+    /* NOTE: mmap() returns page-aligned addresses, so the header and the
+     *       64-bit arrays following it (whose sizes are multiples of 8 bytes)
+     *       are properly aligned                                               */
+    (this->header) = reinterpret_cast<const tokenizer_file_header_t*>((this->file).data());
+
+    if (memcmp(header->magic, magic, sizeof(magic)) != 0) {
+        fail("wrong magic number");
+    }
+
+    if (header->version != version) {
+        ostringstream reason_ss;
+        reason_ss << "unsupported version " << header->version << " (expected " << version << ")";
+        fail(reason_ss.str());
+    }
+
+    if (header->kind != kind) {
+        fail("wrong tokenizer kind");
+    }
+
+    if (header->fingerprint != fingerprint) {
+        fail("the tokenizer was built from a different training text or with different parameters");
+    }
+
+    const auto nids    = header->vocab_size;
+    const auto nmerges = header->nmerges;
+
+    if (nids < 2 or nids > file_size or nmerges > file_size
+        or header->blob_size > file_size or header->eow_size > file_size) {
+        fail("corrupted header");
+    }
+
+    const auto expected_size = sizeof(tokenizer_file_header_t)
+                             + (nids + 1)*sizeof(uint64_t)
+                             + 3*nmerges*sizeof(uint64_t)
+                             + header->blob_size
+                             + header->eow_size;
+
+    if (file_size != expected_size) {
+        fail("file size inconsistent with the header");
+    }
+
+    const auto payload = (this->file).data() + sizeof(tokenizer_file_header_t);
+
+    if (fnv1a_64(payload, file_size - sizeof(tokenizer_file_header_t)) != header->checksum) {
+        fail("checksum mismatch");
+    }
+
+    (this->offsets)    = reinterpret_cast<const uint64_t*>(payload);
+    (this->merges_ptr) = (this->offsets) + nids + 1;
+    (this->blob)       = reinterpret_cast<const char*>((this->merges_ptr) + 3*nmerges);
+
+    if ((this->offsets)[0] != 0 or (this->offsets)[nids] != header->blob_size) {
+        fail("corrupted token offsets");
+    }
+
+    for (auto id = decltype(nids){0}; id < nids; ++id) {
+        if ((this->offsets)[id] > (this->offsets)[id+1]) {
+            fail("corrupted token offsets");
+        }
+    }
+
+    if (header->unk_id >= nids or header->eot_id >= nids) {
+        fail("'unknown' or 'end-of-text' token ID out of range");
+    }
+
+    for (auto rank = decltype(nmerges){0}; rank < nmerges; ++rank) {
+        const auto m = merge(rank);
+
+        if (m.at(0) >= nids or m.at(1) >= nids or m.at(2) >= nids) {
+            fail("merge refers to a token ID out of range");
+        }
+    }
+}
+
+
+
+/* ========================================
+ * Method writing a tokenizer file to disk
+ * ======================================== */
+void tokenizer_file_t::write(const string                     &filename,
+                             const uint32_t                   &kind,
+                             const uint64_t                   &fingerprint,
+                             const flat_vocab_t               &vocab,
+                             const vector<array<uint64_t, 3>> &merges,
+                             const string                     &eow,
+                             const uint64_t                   &unk_id,
+                             const uint64_t                   &eot_id) {
+    const auto nids  = vocab.size();
+    const auto arena = vocab.arena_view();
+
+    // Build the payload (everything after the header) in memory
+    string payload;
+    payload.reserve((nids + 1 + 3*merges.size())*sizeof(uint64_t) + arena.size() + eow.size());
+
+    payload.append(reinterpret_cast<const char*>(vocab.offsets_data()), (nids + 1)*sizeof(uint64_t));
+
+    for (const auto &m : merges) {
+        payload.append(reinterpret_cast<const char*>(m.data()), m.size()*sizeof(uint64_t));
+    }
+
+    payload.append(arena);
+
+    payload.append(eow);
+
+    tokenizer_file_header_t header{};
+    memcpy(header.magic, magic, sizeof(magic));
+    header.version     = version;
+    header.kind        = kind;
+    header.fingerprint = fingerprint;
+    header.vocab_size  = nids;
+    header.nmerges     = merges.size();
+    header.blob_size   = arena.size();
+    header.eow_size    = eow.size();
+    header.unk_id      = unk_id;
+    header.eot_id      = eot_id;
+    header.checksum    = fnv1a_64(payload.data(), payload.size());
+
+    /* Write to a temporary file first and rename it at the end, so that other
+     * processes never map a partially written file                             */
+    const auto tmp_filename = filename + ".tmp";
+    ofstream outfile(tmp_filename, ofstream::binary | ofstream::trunc);
+
+    outfile.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    outfile.write(payload.data(), payload.size());
+    outfile.close();
+
+    if (not outfile) {
+        ostringstream err_ss;
+        err_ss << "tokenizer_file_t::write(): failed to write to file '" << tmp_filename << "'";
+        throw runtime_error(err_ss.str());
+    }
+
+    if (rename(tmp_filename.c_str(), filename.c_str()) != 0) {
+        ostringstream err_ss;
+        err_ss << "tokenizer_file_t::write(): failed to rename file '" << tmp_filename
+               << "' into '" << filename << "'";
+        throw runtime_error(err_ss.str());
+    }
+
+    return;
+}
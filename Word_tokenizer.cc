@@ -1,12 +1,16 @@
+#include <cstdint>
 #include <iostream>
+#include <vector>
 #include <string>
+#include <string_view>
+#include <istream>
+#include <ostream>
 #include <sstream>
 #include <utility>
-#include <unordered_map>
-#include <regex>
-#include <algorithm>
+#include <memory>
 
 #include "Types.hh"
+#include "include/Declare_functions.hh"
 #include "Parameters.hh"
 
 using namespace std;
@@ -16,71 +20,60 @@ using namespace std;
  * Constructor building the token-ti-ID and ID-to-token vocabularies
  * ================================================================= */
 word_tokenizer_t::word_tokenizer_t(const string &training_text) {
-    // This regex matches words, numbers, and punctuation as individual tokens
-    regex                 token_re(R"([a-zA-Z0-9]+|[.,;:!?'"()\[\]\{\}\/\\])");
-    sregex_token_iterator tokens_it(training_text.begin(), training_text.end(), token_re);
-    sregex_token_iterator end;
-
-    size_t id = 0;
-
-    while (tokens_it != end) {
-        /* Make all tokens lowercase to avoid duplicating them if they occur
-         * multiple times with different cases                                  */
-        auto token = tokens_it->str();
-        transform(token.begin(), token.end(), token.begin(), //std::tolower);
-                  /* Wrap std::tolower in a lambda to cast the input into
-                   * unsigned char to avoid undefined behavior if the input
-                   * char is signed and negative (non-ASCII byte)           */
-                  [](unsigned char c)->char {
-                      return static_cast<char>(std::tolower(c));
-                  }
-                 );
-
-        /* Try inserting the token into the token-to-ID vocabulary (O(1) for
-         * token lookup in tokenizer_t::encode()); this will only succeed if the
-         * token is not in the vocabulary yet, since the tokens are the keys in
-         * the map and keys are unique                                          */
-        if ((this->vocab_token2id).emplace(token, id).second) {
-            ++id;
-        } else {
+    /* Split the text into words, numbers, and punctuation characters (all of
+     * them lowercase), each of which is a token                                */
+    pretokenizer_t pretokenizer(training_text);
+
+    while (pretokenizer.next()) {
+        /* Insert the token into the vocabulary (O(1) for token lookup in
+         * tokenizer_t::encode()) if not there yet                              */
+        if (not (this->vocab).insert(pretokenizer.word()).second) {
             #if (VERBOSE)
-            cout << "Skipping repeated token '" << token
+            cout << "Skipping repeated token '" << pretokenizer.word()
                  << "' while creating the token-to-ID vocabulary" << endl;
             #endif
         }
-
-        ++tokens_it;
     }
 
 
     /* Add extra IDs to handle unknown and end-of-text (useful when training
      * with multiple text sources) tokens                                       */
-    const auto original_vocab_size = (this->vocab_token2id).size();
+    const auto original_vocab_size = (this->vocab).size();
     (this->unk) = {"<|unknown|>",     original_vocab_size};
     (this->eot) = {"<|end-of-text|>", original_vocab_size + 1};
 
-    if (not (this->vocab_token2id).emplace(this->unk).second) {
+    if (not (this->vocab).insert((this->unk).first).second) {
         throw runtime_error("word_tokenizer_t(): insertion of 'unknown' token failed");
     }
 
-    if (not (this->vocab_token2id).emplace(this->eot).second) {
+    if (not (this->vocab).insert((this->eot).first).second) {
         throw runtime_error("word_tokenizer_t(): insertion of 'end-of-text' token failed");
     }
+}
 
 
-    /* Build the ID-to-token vocabulary for fast (O(1)) ID lookup in
-     * tokenizer_t::decode()                                                      */
-    (this->vocab_id2token).reserve((this->vocab_token2id).size());
 
-    for (const auto &[token, id] : (this->vocab_token2id)) {
-        if (not (this->vocab_id2token).emplace(id, token).second) {
-            ostringstream exception_ss;
-            exception_ss << "word_tokenizer_t(): unexpected repetition of element [" << id << ", " << token
-                         << "] in the ID-to-token vocabulary. This may happen if ID " << id
-                         << " is not unique in the token-to-ID vocabulary.";
-            throw runtime_error(exception_ss.str());
-        }
-    }
+/* ==========================================================================
+ * Constructor loading the vocabulary from a (validated) binary tokenizer file.
+ * The vocabulary points directly into the memory-mapped file, which is kept
+ * alive by the tokenizer.
+ * ========================================================================== */
+word_tokenizer_t::word_tokenizer_t(const shared_ptr<const tokenizer_file_t> &file)
+    : vocab(file->token_offsets(), file->token_blob(), file->vocab_size(), file) {
+    (this->unk) = {string(file->token(file->unk_id())), file->unk_id()};
+    (this->eot) = {string(file->token(file->eot_id())), file->eot_id()};
+}
+
+
+
+/* ===========================================================
+ * Method saving the vocabulary to a binary tokenizer file
+ * =========================================================== */
+void word_tokenizer_t::save(const string   &filename,
+                            const uint64_t &fingerprint) const {
+    tokenizer_file_t::write(filename, WORD, fingerprint, (this->vocab), {}, "",
+                            (this->unk).second, (this->eot).second);
+    return;
 }
 
 
@@ -89,67 +82,107 @@ word_tokenizer_t::word_tokenizer_t(const string &training_text) {
  * Encode method using the token-to-ID vocabulary to convert an input text into
  * the corresponding set of token IDs
  * ============================================================================ */
-vector<size_t> word_tokenizer_t::encode(const string &text) {
-    // This regex matches words, numbers, and punctuation as individual tokens
-    regex                 token_re(R"([a-zA-Z0-9]+|[.,;:!?'"()\[\]\{\}\/\\])");
-    sregex_token_iterator tokens_it(text.begin(), text.end(), token_re);
-    sregex_token_iterator end;
-
-    const auto nmatches = static_cast<size_t>(distance(tokens_it, end));
-    vector<size_t> tokenIDs(nmatches);
-    size_t m = 0;
-
-    for (sregex_token_iterator it(text.begin(), text.end(), token_re); it != end; ++it, ++m) {
-        /* Make all tokens lowercase to avoid duplicating them if the same
-         * word appears multiple times with different cases                 */
-        auto token = it->str();
-        transform(token.begin(), token.end(), token.begin(), //::tolower);
-                  /* Wrap ::tolower in a lambda to cast the input into
-                   * unsigned char to avoid undefined behavior if the input
-                   * char is signed and negative (non-ASCII byte)           */
-                  [](unsigned char c)->char {
-                      return static_cast<char>(std::tolower(c));
-                  }
-                 );
+vector<size_t> word_tokenizer_t::encode(const string &text) const {
+    vector<size_t> tokenIDs;
+    encode(text, tokenIDs);
+    return tokenIDs;
+}
+
+
+void word_tokenizer_t::encode(const string_view &text,
+                              vector<size_t>    &ids) const {
+    pretokenizer_t pretokenizer(text);
 
+    while (pretokenizer.next()) {
         /* Convert the token into the ID if found in the vocabulary, otherwise
          * set the ID to 'unknown'                                              */
-        try {
-            /* NOTE: the at() method on the RHS throws an exception if the token
-             *       is not in the token-to-ID vocabulary                       */
-            tokenIDs.at(m) = (this->vocab_token2id).at(token);
-        } catch (const exception &e) {
-            tokenIDs.at(m) = (this->unk).second;
-            cerr << "Unknown token '" << token << "': setting ID to 'unknown' token ID "
-                 << (this->unk).second << " (exception: \"" << e.what() << "\")" << endl;
+        const auto id = (this->vocab).find(pretokenizer.word());
+
+        if (id != flat_vocab_t::npos) {
+            ids.emplace_back(id);
+        } else {
+            ids.emplace_back((this->unk).second);
+            cerr << "Unknown token '" << pretokenizer.word() << "': setting ID to 'unknown' token ID "
+                 << (this->unk).second << endl;
         }
     }
 
+    return;
+}
+
+
+
+/* =========================================================================
+ * Method encoding a text in parallel, splitting it into chunks at word
+ * boundaries
+ * ========================================================================= */
+vector<size_t> word_tokenizer_t::encode(const string  &text,
+                                        thread_pool_t &pool) const {
+    auto tokenIDs = encode_parallel(text, pool,
+        [this](const string_view &chunk, vector<size_t> &ids) { encode(chunk, ids); });
+
     return tokenIDs;
 }
 
 
 
+/* ==============================================================================
+ * Methods encoding a whole stream or text chunk by chunk into a token-ID shard
+ * file
+ * ============================================================================== */
+size_t word_tokenizer_t::encode_to_shard(istream      &in,
+                                         const string &filename,
+                                         const size_t &chunk_size) const {
+    return ::encode_to_shard(in, filename, (this->vocab).size(), chunk_size,
+                             [this](const string_view &text, vector<size_t> &ids) { encode(text, ids); });
+}
+
+
+size_t word_tokenizer_t::encode_to_shard(const string_view &text,
+                                         const string      &filename,
+                                         const size_t      &chunk_size) const {
+    return ::encode_to_shard(text, filename, (this->vocab).size(), chunk_size,
+                             [this](const string_view &text, vector<size_t> &ids) { encode(text, ids); });
+}
+
+
+
 /* ========================================================================
- * Decode method using the ID-to-token vocabulary to convert a set of input
+ * Decode methods using the ID-to-token vocabulary to convert a set of input
  * token IDs into the corresponding text tokens
  * ========================================================================= */
-string word_tokenizer_t::decode(const vector<size_t> &ids) {
-    ostringstream decoded_text_ss;
+string word_tokenizer_t::decode(const vector<size_t> &ids) const {
+    string text;
+    decode(ids, text);
+    return text;
+}
+
+
+void word_tokenizer_t::decode(const vector<size_t> &ids,
+                              string               &text) const {
+    const auto nids_vocab = (this->vocab).size();
 
     for (const auto &id : ids) {
-        try {
-            // NOTE: extra space to separate tokens
-            decoded_text_ss << (this->vocab_id2token).at(id) << " ";
-        } catch (const exception &e) {
+        if (id >= nids_vocab) {
             ostringstream exception_ss;
             exception_ss << "word_tokenizer_t::decode(): unknown token ID " << id
-                         << ": this should never happen because the 'unknown' token should be part of the dictionary. Please check the code's correctness (exception: \""
-                         << e.what() << "\")";
+                         << ": this should never happen because the 'unknown' token should be part of the dictionary. Please check the code's correctness";
             throw runtime_error(exception_ss.str());
-            return string();  // Not reached
+            return;  // Not reached
         }
+
+        text.append((this->vocab).token(id));
+        text += ' ';  // NOTE: extra space to separate tokens
     }
 
-    return decoded_text_ss.str();
+    return;
+}
+
+
+
+/* ===========================================================================
+ * Method creating an incremental decoder fed one token ID at a time
+ * =========================================================================== */
+token_decoder_t word_tokenizer_t::decoder(ostream *sink) const {
+    return token_decoder_t((this->vocab), " ", sink);
 }
@@ -5,16 +5,30 @@
 
 static_assert(TOKENIZER == WORD or TOKENIZER == BPE);
 static_assert(BPE_MAX_VOCAB_SIZE > 0);
+static_assert(BPE_ENCODE_CACHE_SIZE >= 0);
 
 static_assert(NTRAIN > 0);
 
 static_assert(DIM > 1);  // At least 2 for the variance of each token embedding vector to be well defined
+static_assert(NHEADS > 0 and DIM % NHEADS == 0);
+static_assert(ATTENTION_WINDOW >= 0 and ATTENTION_NGLOBAL >= 0);
 static_assert(VAR_TINY > 0. and VAR_TINY < 1.);    // Should be positive, but "small"
 static_assert(DROPOUT_PROB <= 1.);                 // Negative means dropout is disabled
 static_assert(FFN_EXPANSION_FACTOR > 0);
 static_assert(LEARNING_RATE > 0.);
 static_assert(TOLERANCE > 0. and TOLERANCE < 1.);  // Should be positive, but "small"
 
+static_assert(TIE_EMBEDDINGS or not TIE_EMBEDDINGS);
+static_assert(LOGITS_CHUNK_SIZE > 0);
+static_assert(LOGITS_NBLOCKS > 0);
+static_assert(GELU_FAST_TANH or not GELU_FAST_TANH);
+static_assert(NTHREADS >= 0);  // 0 means one thread per hardware thread
+
+static_assert(BENCH_NWARMUP >= 0);
+static_assert(BENCH_NREPS > 0);
+static_assert(BENCH_MAX_VOCAB_SIZE >= BPE_MAX_VOCAB_SIZE);
+static_assert(BENCH_MIN_SCALE > 0 and BENCH_MAX_SCALE >= BENCH_MIN_SCALE);
+
 //static_assert(CONTEXT_SIZE > 0);
 static_assert(VERBOSE or not VERBOSE);
 
@@ -1,24 +1,109 @@
 #ifndef DECLARE_FUNCTIONS_HH
 #define DECLARE_FUNCTIONS_HH
 
+#include <cstdint>
 #include <vector>
+#include <string>
+#include <string_view>
+#include <istream>
+#include <functional>
 #include <random>
+#include <array>
+#include <utility>
 
 
-void GELU_approx(std::vector<double> &vec,
-                 std::vector<double> &vec_prime);
+uint64_t fnv1a_64(const void     *data,
+                  const size_t   &size,
+                  const uint64_t &seed = 0xcbf29ce484222325ULL);
 
-void layer_norm(      std::vector<double> &vecs,
-                const std::vector<double> &scale,
-                const std::vector<double> &shift,
-                      std::vector<double> *sigmas_inv = nullptr);
+class thread_pool_t;
+class philox_t;
 
-void skip_conn_dropout(std::vector<double> &vec,
-                       std::vector<double> &dropout_vec,
-                       std::uniform_real_distribution<double> &udist,
-                       std::mt19937 &gen);
+struct kernel_table_t;
 
-void softmax(std::vector<double> &vec);
+template <typename T>
+class tensor_view_t;
+
+std::vector<size_t> encode_parallel(const std::string_view &text,
+                                    thread_pool_t          &pool,
+                                    const std::function<void(const std::string_view&, std::vector<size_t>&)> &encode);
+
+size_t encode_to_shard(std::istream      &in,
+                       const std::string &filename,
+                       const size_t      &vocab_size,
+                       const size_t      &chunk_size,
+                       const std::function<void(const std::string_view&, std::vector<size_t>&)> &encode);
+
+size_t encode_to_shard(const std::string_view &text,
+                       const std::string      &filename,
+                       const size_t           &vocab_size,
+                       const size_t           &chunk_size,
+                       const std::function<void(const std::string_view&, std::vector<size_t>&)> &encode);
+
+std::array<std::pair<size_t, size_t>, 2> attended_keys(const size_t &m,
+                                                       const size_t &window,
+                                                       const size_t &nglobal);
+
+void causal_attention(const tensor_view_t<const double> &queries,
+                      const tensor_view_t<const double> &keys,
+                      const tensor_view_t<const double> &values,
+                      const tensor_view_t<double>       &contexts,
+                      const double                      &scale,
+                      const size_t                      &window  = 0,
+                      const size_t                      &nglobal = 0,
+                      const tensor_view_t<double>       *lse     = nullptr);
+
+void gemm(const tensor_view_t<const double> &A,
+          const tensor_view_t<const double> &B,
+          const tensor_view_t<double>       &C,
+          const bool                        &transpose_A = false,
+          const bool                        &transpose_B = false,
+          const bool                        &accumulate  = false);
+
+void gemm_qkv(const tensor_view_t<const double> &X,
+              const tensor_view_t<const double> &Wq,
+              const tensor_view_t<const double> &Wk,
+              const tensor_view_t<const double> &Wv,
+              const tensor_view_t<double>       &Q,
+              const tensor_view_t<double>       &K,
+              const tensor_view_t<double>       &V,
+              const size_t                      &nheads = 1);
+
+const kernel_table_t &kernels();
+
+void GELU_approx(const tensor_view_t<double> &vec,
+                 const tensor_view_t<double> &vec_prime);
+
+void layer_norm(const tensor_view_t<double>       &vecs,
+                const tensor_view_t<const double> &scale,
+                const tensor_view_t<const double> &shift,
+                const tensor_view_t<double>       *sigmas_inv = nullptr);
+
+double logits_cross_entropy(const tensor_view_t<const double> &inputs,
+                            const std::vector<size_t>         &targets,
+                            const tensor_view_t<const double> &W,
+                            const tensor_view_t<const double> &b,
+                            const tensor_view_t<double>       &d_W,
+                            const tensor_view_t<double>       &d_b,
+                            const tensor_view_t<double>       &d_inputs,
+                            thread_pool_t                     &pool);
+
+void skip_conn_dropout(const tensor_view_t<double> &vec,
+                       const tensor_view_t<double> &dropout_vec,
+                       const philox_t              &rng,
+                       const uint64_t              &stream);
+
+void skip_conn_dropout_layer_norm(const tensor_view_t<double>       &vec,
+                                  const tensor_view_t<double>       &dropout_vec,
+                                  const philox_t                    &rng,
+                                  const uint64_t                    &stream,
+                                  const tensor_view_t<const double> &scale,
+                                  const tensor_view_t<const double> &shift,
+                                  thread_pool_t                     &pool,
+                                  const tensor_view_t<double>       *sigmas_inv = nullptr,
+                                  const tensor_view_t<uint8_t>      *mask       = nullptr);
+
+void softmax(const tensor_view_t<double> &vecs);
 
 
 #endif
@@ -0,0 +1,222 @@
+/* -----------------------------------------------------------------------------
+ * Bodies of the numeric kernels. This file is included once per instruction
+ * set by Kernels*.cc, each compiled with different target flags, after
+ * defining:
+ *   - KERNELS_TABLE: name of the kernel table (kernel_table_t) to define
+ *   - KERNELS_ISA:   name of the instruction set, as a string
+ * NOTE: the kernels live in an anonymous namespace and only use raw loops and
+ *   C math functions (C++ math functions only in constant expressions), so
+ *   that the linker can't pick code compiled for one instruction set when
+ *   another one is in use. This could happen with inline functions from shared
+ *   headers, which are emitted in every translation unit using them.
+ * ----------------------------------------------------------------------------- */
+
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+
+#include "Types.hh"
+#include "../Parameters.hh"
+
+#if !defined(KERNELS_TABLE) || !defined(KERNELS_ISA)
+#error "KERNELS_TABLE and KERNELS_ISA must be defined before including Kernels_impl.hh"
+#endif
+
+
+namespace {
+
+constexpr size_t MR = kernel_table_t::gemm_mr;
+constexpr size_t NR = kernel_table_t::gemm_nr;
+
+
+/* ==========================================================================
+ * GEMM micro-kernel: MR x NR tile of the result accumulated over a packed
+ * strip of A (MR rows) and of B (NR columns)
+ * ========================================================================== */
+void gemm_micro_kernel(const size_t &kc,
+                       const double *__restrict__ Ap,
+                       const double *__restrict__ Bp,
+                       double       *__restrict__ acc) {
+    double tile[MR*NR];
+
+    for (size_t idx = 0; idx < MR*NR; ++idx) {
+        tile[idx] = acc[idx];
+    }
+
+    for (size_t k = 0; k < kc; ++k) {
+        const auto *a = Ap + k*MR;
+        const auto *b = Bp + k*NR;
+
+        for (size_t i = 0; i < MR; ++i) {
+            for (size_t j = 0; j < NR; ++j) {
+                tile[i*NR + j] += a[i]*b[j];
+            }
+        }
+    }
+
+    for (size_t idx = 0; idx < MR*NR; ++idx) {
+        acc[idx] = tile[idx];
+    }
+
+    return;
+}
+
+
+
+/* ==============================================================
+ * Softmax normalization of one vector (stabilized by subtracting
+ * the largest element)
+ * ============================================================== */
+void softmax_kernel(double       *vec,
+                    const size_t &n) {
+    double max = -HUGE_VAL;
+
+    // Find the largest element
+    for (size_t idx = 0; idx < n; ++idx) {
+        max = (vec[idx] > max) ? vec[idx] : max;
+    }
+
+    assert(max > -HUGE_VAL and max < HUGE_VAL);
+    double sum_exp = 0.;
+
+    for (size_t idx = 0; idx < n; ++idx) {
+        const auto exp_att = ::exp(vec[idx] - max);
+        vec[idx] = exp_att;
+        sum_exp += exp_att;
+    }
+
+    assert(sum_exp > 0.);
+
+    for (size_t idx = 0; idx < n; ++idx) {
+        vec[idx] /= sum_exp;
+    }
+
+    return;
+}
+
+
+
+/* ==========================================================================
+ * Layer normalization of one vector: have its components average out to 0
+ * and have variance 1, then scale and shift them. Returns the inverse
+ * standard deviation.
+ * ========================================================================== */
+double layer_norm_kernel(double       *vec,
+                         const size_t &n,
+                         const double *scale,
+                         const double *shift) {
+    double mean      = 0.;
+    double sum_diffs = 0.;
+
+    /* Welford's algorithm to compute the mean and variance of a sample in one
+     * pass and without a potential catastrophic cancellation when computing
+     * the variance                                                             */
+    for (size_t i = 0; i < n; ++i) {
+        const auto delta1 = vec[i] - mean;
+                   mean  += delta1/static_cast<double>(i+1);
+        const auto delta2 = vec[i] - mean;
+               sum_diffs += delta1*delta2;
+    }
+
+    /* NOTE: sum_diffs==0 can only happen if all elements in the vector are the
+     *       same, which is very unlikely                                       */
+    assert(sum_diffs >= 0.);
+    constexpr auto sigma_inv_fallback = 1./std::sqrt(static_cast<double>(VAR_TINY));
+    const     auto sigma_inv          = (sum_diffs == 0.) ? sigma_inv_fallback : ::sqrt(static_cast<double>(n-1)/sum_diffs);
+    assert(sigma_inv > 0.);
+
+    for (size_t i = 0; i < n; ++i) {
+        vec[i] = scale[i]*(sigma_inv*(vec[i] - mean)) + shift[i];
+    }
+
+    return sigma_inv;
+}
+
+
+
+/* ==========================================================================
+ * Branch-free hyperbolic tangent, vectorizable by the compiler:
+ *   tanh(|y|) = (1 - t)/(1 + t),  t = exp(-2|y|) = 2^n*exp(r)
+ * with n the integer nearest to -2|y|/ln(2), |r| <= ln(2)/2, exp(r) computed
+ * from its Taylor polynomial of degree 13, and 2^n built directly from its
+ * bits. The absolute error vs. the C library tanh() is below 4.e-16 for all
+ * finite arguments (see GELU_approx_kernel() for the effect on GELU).
+ * ========================================================================== */
+inline double fast_tanh(const double &y) {
+    constexpr double ln2_hi  = 6.93147180369123816490e-01;  // ln(2) with the last 32 bits zeroed
+    constexpr double ln2_lo  = 1.90821492927058770002e-10;  // ln(2) - ln2_hi
+    constexpr double log2e   = 1.44269504088896338700e+00;
+    constexpr double shifter = 6755399441055744.;           // 1.5*2^52: adding it rounds to an integer
+    constexpr double y_max   = 20.;                         // tanh(20) is 1 in double precision
+
+    const auto abs_y = ::fabs(y);
+    const auto z     = -2.*((abs_y < y_max) ? abs_y : y_max);
+
+    // z = n*ln(2) + r
+    const auto n_shifted = z*log2e + shifter;
+    const auto n         = n_shifted - shifter;
+    const auto r         = (z - n*ln2_hi) - n*ln2_lo;
+
+    // Taylor polynomial of exp(r), coefficients 1/k!, in Horner form
+    const auto exp_r = 1. + r*(1. + r*(1./2. + r*(1./6. + r*(1./24. + r*(1./120. + r*(1./720.
+                     + r*(1./5040. + r*(1./40320. + r*(1./362880. + r*(1./3628800. + r*(1./39916800.
+                     + r*(1./479001600. + r*(1./6227020800.)))))))))))));
+
+    // 2^n: the low bits of n_shifted hold n, n in [-58, 0]
+    uint64_t n_bits, shifter_bits;
+    memcpy(&n_bits,       &n_shifted, sizeof(double));
+    memcpy(&shifter_bits, &shifter,   sizeof(double));
+
+    const uint64_t pow2_bits = (n_bits - shifter_bits + 1023) << 52;
+    double         pow2_n;
+    memcpy(&pow2_n, &pow2_bits, sizeof(double));
+
+    const auto t  = pow2_n*exp_r;
+    const auto th = (1. - t)/(1. + t);
+
+    return ::copysign(th, y);
+}
+
+
+
+/* ==========================================================================
+ * Tanh approximation of GELU and of its derivative, element-wise. With
+ * GELU_FAST_TANH, fast_tanh() replaces the C library tanh(). The largest
+ * differences between the two versions, measured over 6.e+07 inputs in
+ * [-30, 30], are 4.e-16*max(1, |x|) for GELU and 6.e-15 (absolute) for its
+ * derivative.
+ * ========================================================================== */
+void GELU_approx_kernel(double       *__restrict__ vec,
+                        double       *__restrict__ vec_prime,
+                        const size_t &n) {
+    constexpr double sqrt_2_over_pi = std::sqrt(2./M_PI);
+    constexpr double a              = 0.044715;
+
+    for (size_t idx = 0; idx < n; ++idx) {
+        const auto x    = vec[idx];
+        const auto x2   = x*x;
+        const auto y    = sqrt_2_over_pi*x*(1. + a*x2);
+        const auto th   = GELU_FAST_TANH ? fast_tanh(y) : ::tanh(y);
+        const auto thp1 = th + 1.;
+
+        vec[idx]       = 0.5*x*thp1;
+        vec_prime[idx] = 0.5*(thp1 + sqrt_2_over_pi*x*(1. + 3.*a*x2)*(1. - th*th));
+    }
+
+    return;
+}
+
+}  // namespace
+
+
+
+extern const kernel_table_t KERNELS_TABLE;
+
+const kernel_table_t KERNELS_TABLE = {
+    KERNELS_ISA,
+    gemm_micro_kernel,
+    softmax_kernel,
+    layer_norm_kernel,
+    GELU_approx_kernel
+};
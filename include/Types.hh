@@ -1,9 +1,395 @@
 #ifndef TYPES_HH
 #define TYPES_HH
 
+#include <cassert>
+#include <cstdint>
+#include <array>
+#include <algorithm>
+#include <limits>
 #include <vector>
 #include <string>
+#include <string_view>
+#include <fstream>
+#include <istream>
+#include <ostream>
+#include <utility>
+#include <functional>
 #include <unordered_map>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <exception>
+#include <shared_mutex>
+#include <atomic>
+#include <memory>
+
+
+/* ---------------------------------------------------------------------------
+ * Pair of adjacent symbol IDs used by the BPE tokenizer, and the corresponding
+ * hash function so that symbol pairs can be used as hash map keys
+ * --------------------------------------------------------------------------- */
+using symbolpair_t = std::pair<size_t, size_t>;
+
+struct symbolpair_hash_t {
+    size_t operator()(const symbolpair_t &symbol_pair) const noexcept {
+        // Mix the two IDs so that (a, b) and (b, a) hash differently
+        return std::hash<size_t>{}(symbol_pair.first*0x9e3779b97f4a7c15ULL ^ symbol_pair.second);
+    }
+};
+
+
+/* -----------------------------------------------------------------------------
+ * Pool of worker threads running the same task on every thread, the calling
+ * thread included (as thread 0). Work is always split statically across the
+ * threads, so that results which are reduced in order of thread ID don't depend
+ * on thread scheduling.
+ * ----------------------------------------------------------------------------- */
+class thread_pool_t {
+    private:
+        std::vector<std::thread> workers;
+
+        std::mutex              mtx;
+        std::condition_variable cv_start, cv_done;
+
+        const std::function<void(const size_t&)> *task;  // Current task, called with the thread ID
+        size_t             generation;  // Incremented every time a new task is started
+        size_t             npending;    // Number of workers still running the current task
+        bool               stop;
+        std::exception_ptr exception;   // First exception thrown by a worker
+
+        void worker_loop(const size_t thread_id);
+
+    public:
+        // Constructor (nthreads=0 means one thread per hardware thread)
+        thread_pool_t(const size_t &nthreads);
+        ~thread_pool_t();
+
+        thread_pool_t(const thread_pool_t&)            = delete;
+        thread_pool_t &operator=(const thread_pool_t&) = delete;
+
+        // Total number of threads, the calling thread included
+        size_t size() const { return workers.size() + 1; }
+
+        /* Run task(thread_id) on every thread and wait for all of them to be
+         * done; rethrows the first exception thrown by any thread              */
+        void run(const std::function<void(const size_t&)> &task);
+
+        /* Split [0, n) into size() contiguous chunks (the first ones possibly
+         * one element larger than the others) and call
+         * func(begin, end, thread_id) on each of them                          */
+        void parallel_for(const size_t &n,
+                          const std::function<void(const size_t&, const size_t&, const size_t&)> &func);
+};
+
+
+/* -----------------------------------------------------------------------------
+ * Pre-tokenizer splitting a text into words, numbers, and punctuation
+ * characters (the latter being single-character words), skipping everything
+ * else. Words are made lowercase to avoid duplicating them if they occur
+ * multiple times with different cases.
+ * NOTE: the text must outlive the pre-tokenizer
+ * ----------------------------------------------------------------------------- */
+class pretokenizer_t {
+    private:
+        std::string_view text;
+        size_t           pos_begin, pos_end;  // Span of the current word in the text
+        std::string      buffer;              // Current word, lowercase
+
+    public:
+        // Constructor
+        pretokenizer_t(const std::string_view &text)
+            : text(text), pos_begin(0), pos_end(0) {}
+
+        // Advance to the next word; returns false at the end of the text
+        bool next();
+
+        /* Current word (lowercase) and its span in the original text
+         * NOTE: the word is only valid until the next call to next()          */
+        std::string_view word()  const { return buffer; }
+        std::string_view span()  const { return text.substr(pos_begin, pos_end - pos_begin); }
+        size_t           begin() const { return pos_begin; }
+        size_t           end()   const { return pos_end; }
+
+        /* Largest position in the text such that cutting the text there never
+         * splits a word (0 if there is no such position other than the start
+         * of the text)                                                         */
+        static size_t last_boundary(const std::string_view &text);
+};
+
+
+/* -----------------------------------------------------------------------------
+ * Flat vocabulary relating tokens to dense integer IDs 0, 1, ..., size()-1 and
+ * vice versa. All the tokens are stored back to back in a single string arena,
+ * and the ID-to-token lookup is an index into an array of offsets into the
+ * arena. The token-to-ID lookup goes through an open-addressing (linear
+ * probing) hash table of IDs, which can be probed with a string_view without
+ * allocating any memory. The arena and the offsets are either owned by the
+ * vocabulary (when building it) or external, read-only storage (e.g., a
+ * memory-mapped tokenizer file) kept alive by the vocabulary.
+ * ----------------------------------------------------------------------------- */
+class flat_vocab_t {
+    private:
+        std::string           arena_owned;
+        std::vector<uint64_t> offsets_owned;  // size()+1 entries
+
+        const char     *arena_external;
+        const uint64_t *offsets_external;
+        size_t          ntokens;
+        std::shared_ptr<const void> keepalive;  // Owner of the external storage
+
+        std::vector<uint32_t> slots;  // Token IDs + 1 (0 means empty slot)
+
+        const char     *arena()   const { return keepalive ? arena_external   : arena_owned.data(); }
+        const uint64_t *offsets() const { return keepalive ? offsets_external : offsets_owned.data(); }
+
+        // Insert token ID 'id' into the hash table, which must have room for it
+        void insert_slot(const size_t &id);
+
+        // Resize the hash table to the given number of slots (a power of 2)
+        void rehash(const size_t &nslots);
+
+    public:
+        static constexpr size_t npos = std::numeric_limits<size_t>::max();
+
+        // Empty vocabulary to be filled with insert()
+        flat_vocab_t();
+
+        /* Read-only vocabulary of 'ntokens' tokens stored in external memory,
+         * kept alive by 'keepalive'; throws if a token is repeated             */
+        flat_vocab_t(const uint64_t              *offsets,
+                     const char                  *arena,
+                     const size_t                &ntokens,
+                     std::shared_ptr<const void>  keepalive);
+
+        size_t size() const { return ntokens; }
+
+        // ID-to-token lookup without and with bounds checking
+        std::string_view token(const size_t &id) const {
+            const auto off = offsets();
+            return std::string_view(arena() + off[id], off[id+1] - off[id]);
+        }
+
+        std::string_view at(const size_t &id) const;
+
+        // Token-to-ID lookup (npos if the token is not in the vocabulary)
+        size_t find(const std::string_view &token) const;
+
+        /* Insert a token with ID size() if not in the vocabulary yet; returns
+         * the token ID and whether the insertion took place                    */
+        std::pair<size_t, bool> insert(const std::string_view &token);
+
+        // Raw storage, e.g., to save the vocabulary to file
+        const uint64_t   *offsets_data() const { return offsets(); }
+        std::string_view  arena_view()   const { return std::string_view(arena(), offsets()[ntokens]); }
+};
+
+
+/* -----------------------------------------------------------------------------
+ * Incremental decoder turning token IDs into text one ID at a time (e.g., as
+ * they are generated), appending each token and a separator to a buffer with a
+ * single copy. If a sink is given, the buffer is written to it whenever it
+ * grows beyond 'flush_size' bytes and on destruction; otherwise the decoded
+ * text accumulates until the caller takes it with text() and clear(). The
+ * vocabulary must outlive the decoder.
+ * ----------------------------------------------------------------------------- */
+class token_decoder_t {
+    private:
+        const flat_vocab_t &vocab;
+        std::string_view    separator;
+        std::ostream       *sink;
+        size_t              flush_size;
+        std::string         buffer;
+
+    public:
+        // Constructor and destructor (the latter flushes the buffer to the sink)
+        token_decoder_t(const flat_vocab_t     &vocab,
+                        const std::string_view &separator,
+                        std::ostream           *sink       = nullptr,
+                        const size_t           &flush_size = 4096);
+        ~token_decoder_t();
+
+        token_decoder_t(const token_decoder_t&)            = delete;
+        token_decoder_t &operator=(const token_decoder_t&) = delete;
+
+        // Decode one or more token IDs (throws on unknown IDs)
+        void push(const size_t &id);
+        void push(const std::vector<size_t> &ids);
+
+        // Decoded text not yet written to the sink, and buffer reset
+        std::string_view text() const { return buffer; }
+        void clear() { buffer.clear(); }
+
+        // Write the decoded text to the sink (if any) and reset the buffer
+        void flush();
+};
+
+
+/* -----------------------------------------------------------------------------
+ * Read-only memory mapping of a whole file. The mapped pages are shared with
+ * all the other processes mapping the same file on the same host.
+ * ----------------------------------------------------------------------------- */
+class mapped_file_t {
+    private:
+        const char *ptr;
+        size_t      len;
+
+    public:
+        // Constructor and destructor
+        mapped_file_t(const std::string &filename);
+        ~mapped_file_t();
+
+        // Mappings can't be copied, since the destructor unmaps the file
+        mapped_file_t(const mapped_file_t&)            = delete;
+        mapped_file_t &operator=(const mapped_file_t&) = delete;
+
+        const char *data() const { return ptr; }
+        size_t      size() const { return len; }
+};
+
+
+/* -----------------------------------------------------------------------------
+ * Binary tokenizer file, storing a trained vocabulary and (for the BPE
+ * tokenizer) the merge list so that the tokenizer doesn't need to be retrained
+ * at every run. Layout (native endianness, all integers 64-bit unless noted):
+ *   1. Header (see tokenizer_file_header_t)
+ *   2. Offsets of each token in the string blob, indexed by token ID, plus one
+ *      final entry equal to the size of the blob ('vocab_size' + 1 entries)
+ *   3. Merges in order of rank, as (left ID, right ID, merged ID) triplets
+ *      ('nmerges' entries)
+ *   4. String blob with all the tokens, concatenated in order of ID
+ *   5. End-of-word string ('eow_size' characters)
+ * The checksum is computed over everything after the header. The fingerprint
+ * identifies the training setup (training text and tokenizer parameters) the
+ * tokenizer was built from, so that stale files can be detected.
+ * ----------------------------------------------------------------------------- */
+struct tokenizer_file_header_t {
+    char     magic[8];
+    uint32_t version;
+    uint32_t kind;  // WORD or BPE
+    uint64_t fingerprint;
+    uint64_t vocab_size;
+    uint64_t nmerges;
+    uint64_t blob_size;
+    uint64_t eow_size;
+    uint64_t unk_id, eot_id;
+    uint64_t checksum;
+};
+
+class tokenizer_file_t {
+    private:
+        mapped_file_t file;
+
+        const tokenizer_file_header_t *header;
+        const uint64_t *offsets;
+        const uint64_t *merges_ptr;
+        const char     *blob;
+
+    public:
+        static constexpr char     magic[8] = {'L', 'L', 'M', 'T', 'O', 'K', 'E', 'N'};
+        static constexpr uint32_t version  = 1;
+
+        /* Map a tokenizer file and validate it against the expected tokenizer
+         * kind and training fingerprint (throws if validation fails)          */
+        tokenizer_file_t(const std::string &filename,
+                         const uint32_t    &kind,
+                         const uint64_t    &fingerprint);
+
+        // Write a tokenizer file
+        static void write(const std::string  &filename,
+                          const uint32_t     &kind,
+                          const uint64_t     &fingerprint,
+                          const flat_vocab_t &vocab,
+                          const std::vector<std::array<uint64_t, 3>> &merges,
+                          const std::string  &eow,
+                          const uint64_t     &unk_id,
+                          const uint64_t     &eot_id);
+
+        size_t vocab_size() const { return header->vocab_size; }
+        size_t nmerges()    const { return header->nmerges; }
+        size_t unk_id()     const { return header->unk_id; }
+        size_t eot_id()     const { return header->eot_id; }
+
+        std::string_view token(const size_t &id) const {
+            return std::string_view(blob + offsets[id], offsets[id+1] - offsets[id]);
+        }
+
+        // Token offsets and string blob, to be used directly by flat_vocab_t
+        const uint64_t *token_offsets() const { return offsets; }
+        const char     *token_blob()    const { return blob; }
+
+        std::array<uint64_t, 3> merge(const size_t &rank) const {
+            return {merges_ptr[3*rank], merges_ptr[3*rank + 1], merges_ptr[3*rank + 2]};
+        }
+
+        std::string_view eow() const {
+            return std::string_view(blob + header->blob_size, header->eow_size);
+        }
+};
+
+
+/* -----------------------------------------------------------------------------
+ * Token-ID shard file, storing a pre-tokenized corpus so that it can be
+ * memory-mapped later on without having to re-encode it. Layout (native
+ * endianness):
+ *   1. Header (see token_shard_header_t)
+ *   2. 'ntokens' token IDs, stored as 16-bit unsigned integers if the
+ *      vocabulary size fits into them and as 32-bit unsigned integers
+ *      otherwise
+ * ----------------------------------------------------------------------------- */
+struct token_shard_header_t {
+    char     magic[8];
+    uint32_t version;
+    uint32_t id_size;  // Bytes per token ID (2 or 4)
+    uint64_t vocab_size;
+    uint64_t ntokens;
+};
+
+class token_shard_writer_t {
+    private:
+        std::ofstream         outfile;
+        std::string           filename;
+        token_shard_header_t  header;
+        std::vector<char>     buffer;  // Token IDs converted to the on-disk integer type
+        bool                  closed;
+
+    public:
+        static constexpr char     magic[8] = {'L', 'L', 'M', 'S', 'H', 'A', 'R', 'D'};
+        static constexpr uint32_t version  = 1;
+
+        // Constructor and destructor (the latter closes the file if needed)
+        token_shard_writer_t(const std::string &filename,
+                             const size_t      &vocab_size);
+        ~token_shard_writer_t();
+
+        // Append token IDs to the shard
+        void append(const std::vector<size_t> &ids);
+
+        /* Write the final header and close the file; returns the total number
+         * of tokens in the shard                                               */
+        size_t close();
+};
+
+class token_shard_t {
+    private:
+        mapped_file_t file;
+
+        const token_shard_header_t *header;
+        const char                 *ids;
+
+    public:
+        // Map a shard file into memory and validate it
+        token_shard_t(const std::string &filename);
+
+        size_t ntokens()    const { return header->ntokens; }
+        size_t vocab_size() const { return header->vocab_size; }
+
+        // Token ID at position 'i' (no bounds checking)
+        size_t operator[](const size_t &i) const {
+            return (header->id_size == sizeof(uint16_t))
+                ? static_cast<size_t>(reinterpret_cast<const uint16_t*>(ids)[i])
+                : static_cast<size_t>(reinterpret_cast<const uint32_t*>(ids)[i]);
+        }
+};
 
 
 /* --------------
@@ -15,19 +401,85 @@ class word_tokenizer_t {
         std::pair<std::string, size_t> unk, eot;
 
     public:
-        /* Token-to-ID and ID-to-token vocabularies, i.e., hash maps relating
-         * unique tokens from a training text to integer IDs and vice versa     */
-        std::unordered_map<std::string, size_t> vocab_token2id;  // Fast (O(1)) for token lookup in word_tokenizer_t::encode()
-        std::unordered_map<size_t, std::string> vocab_id2token;  // Fast (O(1)) for ID    lookup in word_tokenizer_t::decode()
+        /* Vocabulary relating unique tokens from a training text to integer IDs
+         * and vice versa (O(1) lookups both ways)                              */
+        flat_vocab_t vocab;
 
-        // Constructor
+        // Constructors
         word_tokenizer_t(const std::string &training_text);
+        word_tokenizer_t(const std::shared_ptr<const tokenizer_file_t> &file);
+
+        // Save the vocabulary to a binary tokenizer file
+        void save(const std::string &filename,
+                  const uint64_t    &fingerprint) const;
+
+        // Encode (token-to-ID) methods
+        std::vector<size_t> encode(const std::string &text) const;
+        void encode(const std::string_view &text, std::vector<size_t> &ids) const;  // Appends to 'ids'
+        std::vector<size_t> encode(const std::string &text, thread_pool_t &pool) const;  // Parallel, same result as the serial version
+
+        /* Encode a whole stream or text chunk by chunk (cutting chunks at word
+         * boundaries) into a token-ID shard file; returns the number of tokens */
+        size_t encode_to_shard(std::istream      &in,
+                               const std::string &filename,
+                               const size_t      &chunk_size) const;
+        size_t encode_to_shard(const std::string_view &text,
+                               const std::string      &filename,
+                               const size_t           &chunk_size) const;
 
-        // Encode (token-to-ID) method
-        std::vector<size_t> encode(const std::string &text);
+        /* Decode (ID-to-token) methods, either returning a new string or
+         * appending to the caller's buffer                                     */
+        std::string decode(const std::vector<size_t> &ids) const;
+        void decode(const std::vector<size_t> &ids, std::string &text) const;  // Appends to 'text'
 
-        // Decode (ID-to-token) method
-        std::string decode(const std::vector<size_t> &ids);
+        /* Incremental decoder fed one token ID at a time, optionally writing
+         * the decoded text to 'sink'                                           */
+        token_decoder_t decoder(std::ostream *sink = nullptr) const;
+};
+
+
+/* -----------------------------------------------------------------------------
+ * Bounded cache of word->token IDs used by the BPE tokenizer to avoid re-merging
+ * frequent words. The cache is split into shards, each protected by its own
+ * readers-writer lock, so that it can be shared by threads encoding
+ * concurrently. Once a shard is full, no more words are inserted into it: since
+ * natural text is Zipfian, the most frequent words are very likely to be cached
+ * by then.
+ * ----------------------------------------------------------------------------- */
+class encode_cache_t {
+    private:
+        static constexpr size_t nshards = 64;
+
+        struct shard_t {
+            mutable std::shared_mutex mtx;
+            std::unordered_map<std::string, std::vector<size_t>> word2ids;
+        };
+
+        std::array<shard_t, nshards> shards;
+        size_t capacity_per_shard;
+
+        mutable std::atomic<size_t> hits, misses;
+
+        const shard_t &shard(const std::string &word) const {
+            return shards[std::hash<std::string>{}(word) % nshards];
+        }
+        shard_t &shard(const std::string &word) {
+            return shards[std::hash<std::string>{}(word) % nshards];
+        }
+
+    public:
+        // Constructor (capacity = maximum number of cached words)
+        encode_cache_t(const size_t &capacity);
+
+        /* Append the token IDs of 'word' to 'ids' if the word is cached;
+         * returns whether the word was found                                   */
+        bool find(const std::string &word, std::vector<size_t> &ids) const;
+
+        // Cache the token IDs of 'word' (no-op if the shard is full)
+        void insert(const std::string &word, const size_t *ids_begin, const size_t *ids_end);
+
+        size_t nhits()   const { return hits.load(std::memory_order_relaxed); }
+        size_t nmisses() const { return misses.load(std::memory_order_relaxed); }
 };
 
 
@@ -42,22 +494,374 @@ class bpe_tokenizer_t {
         // 'End-of-word' token
         std::string eow;
 
+        /* Merge-rank table relating each pair of symbol IDs merged during
+         * training to the order ("rank") in which the merge happened and to
+         * the ID of the merged symbol                                          */
+        std::unordered_map<symbolpair_t, std::pair<size_t, size_t>, symbolpair_hash_t> merges;
+
+        /* IDs of the single-character symbols without and with the end-of-word
+         * token appended, indexed by character ('unknown' token ID if the
+         * symbol is not in the vocabulary)                                     */
+        std::array<size_t, 256> char2id, char_eow2id;
+
+        // Optional cache of word->token IDs (nullptr if disabled)
+        std::unique_ptr<encode_cache_t> cache;
+
+        // Scratch buffers reused across words by encode_word()
+        struct encode_scratch_t {
+            std::vector<size_t> symbols, prev, next;
+            std::vector<std::pair<size_t, size_t>> heap;  // (rank, position) pairs
+        };
+
+        /* Build the character-to-ID tables out of the token-to-ID vocabulary
+         * and the end-of-word token                                            */
+        void build_char_tables();
+
+        // Encode a single (lowercase) word, appending its token IDs to 'ids'
+        void encode_word(const std::string_view &word,
+                         encode_scratch_t       &scratch,
+                         std::vector<size_t>    &ids) const;
+
     public:
-        /* Token-to-ID and ID-to-token vocabularies, i.e., hash maps relating
-         * unique tokens from a training text to integer IDs and vice versa     */
-        std::unordered_map<std::string, size_t> vocab_token2id;
-        std::unordered_map<size_t, std::string> vocab_id2token;
+        /* Vocabulary relating unique tokens from a training text to integer IDs
+         * and vice versa (O(1) lookups both ways)                              */
+        flat_vocab_t vocab;
 
-        // Constructor
+        // Constructors
         bpe_tokenizer_t(const std::string &training_text,
                         const std::string &eow,
-                        const size_t      &max_vocab_size);
+                        const size_t      &max_vocab_size,
+                        const size_t      &nthreads);
+        bpe_tokenizer_t(const std::shared_ptr<const tokenizer_file_t> &file);
+
+        /* Enable the word->token IDs cache with the given capacity (number of
+         * words; 0 disables the cache) and get the cache hit/miss counters
+         * NOTE: don't call enable_cache() while other threads are encoding     */
+        void   enable_cache(const size_t &capacity);
+        size_t cache_hits()   const;
+        size_t cache_misses() const;
+
+        // Save the vocabulary and the merge list to a binary tokenizer file
+        void save(const std::string &filename,
+                  const uint64_t    &fingerprint) const;
+
+        // Encode (token-to-ID) methods
+        std::vector<size_t> encode(const std::string &text) const;
+        void encode(const std::string_view &text, std::vector<size_t> &ids) const;  // Appends to 'ids'
+        std::vector<size_t> encode(const std::string &text, thread_pool_t &pool) const;  // Parallel, same result as the serial version
+
+        /* Encode a whole stream or text chunk by chunk (cutting chunks at word
+         * boundaries) into a token-ID shard file; returns the number of tokens */
+        size_t encode_to_shard(std::istream      &in,
+                               const std::string &filename,
+                               const size_t      &chunk_size) const;
+        size_t encode_to_shard(const std::string_view &text,
+                               const std::string      &filename,
+                               const size_t           &chunk_size) const;
+
+        /* Decode (ID-to-token) methods, either returning a new string or
+         * appending to the caller's buffer                                     */
+        std::string decode(const std::vector<size_t> &ids) const;
+        void decode(const std::vector<size_t> &ids, std::string &text) const;  // Appends to 'text'
+
+        /* Incremental decoder fed one token ID at a time, optionally writing
+         * the decoded text to 'sink'                                           */
+        token_decoder_t decoder(std::ostream *sink = nullptr) const;
+};
+
+
+/* -----------------------------------------------------------------------------
+ * Counter-based pseudo-random number generator (Philox4x32-10, Salmon et al.,
+ * "Parallel random numbers: as easy as 1, 2, 3", SC'11). Each draw is a pure
+ * function of the key (seed), of a stream ID, and of an index within the
+ * stream, so that draws can be made in any order, in parallel, or again later
+ * (e.g., to regenerate a dropout mask in the backward pass) with identical
+ * results. There is no state besides the key.
+ * ----------------------------------------------------------------------------- */
+class philox_t {
+    private:
+        std::array<uint32_t, 2> key;
+
+        static constexpr uint32_t M0 = 0xD2511F53, M1 = 0xCD9E8D57;  // Multipliers
+        static constexpr uint32_t W0 = 0x9E3779B9, W1 = 0xBB67AE85;  // Weyl sequence increments (key schedule)
+
+    public:
+        explicit philox_t(const uint64_t &seed)
+            : key{static_cast<uint32_t>(seed), static_cast<uint32_t>(seed >> 32)} {}
+
+        // The 128 random bits for a counter, after ten rounds
+        std::array<uint32_t, 4> operator()(const std::array<uint32_t, 4> &counter) const {
+            auto ctr = counter;
+            auto k0  = key[0];
+            auto k1  = key[1];
+
+            for (int round = 0; round < 10; ++round) {
+                const auto p0 = static_cast<uint64_t>(M0)*ctr[0];
+                const auto p1 = static_cast<uint64_t>(M1)*ctr[2];
+
+                ctr = {static_cast<uint32_t>(p1 >> 32) ^ ctr[1] ^ k0, static_cast<uint32_t>(p1),
+                       static_cast<uint32_t>(p0 >> 32) ^ ctr[3] ^ k1, static_cast<uint32_t>(p0)};
+                k0 += W0;
+                k1 += W1;
+            }
+
+            return ctr;
+        }
+
+        // Stream ID of, e.g., a dropout layer at a given training iteration
+        static uint64_t stream(const uint64_t &iteration,
+                               const uint32_t &layer) {
+            return (iteration << 32) | layer;
+        }
+
+        // Uniformly distributed double in [0, 1) for element 'index' of 'stream'
+        double uniform(const uint64_t &stream,
+                       const uint64_t &index) const {
+            const auto r    = (*this)({static_cast<uint32_t>(index), static_cast<uint32_t>(index >> 32),
+                                       static_cast<uint32_t>(stream), static_cast<uint32_t>(stream >> 32)});
+            const auto bits = ((static_cast<uint64_t>(r[0]) << 32) | r[1]) >> 11;  // 53 random bits
+            return static_cast<double>(bits)*0x1.p-53;
+        }
+};
+
+
+/* -----------------------------------------------------------------------------
+ * Table of the numeric kernels compiled for one instruction set. Each kernel
+ * works on raw, contiguous arrays; the tensor-level routines (gemm(),
+ * softmax(), layer_norm(), GELU_approx()) check the shapes and call the kernels
+ * of the table selected at startup by kernels().
+ * ----------------------------------------------------------------------------- */
+struct kernel_table_t {
+    // Size of the tiles of the GEMM micro-kernel
+    static constexpr size_t gemm_mr = 4;
+    static constexpr size_t gemm_nr = 8;
+
+    const char *isa;
+
+    /* acc[i*gemm_nr + j] += sum_k Ap[k*gemm_mr + i]*Bp[k*gemm_nr + j] over
+     * packed strips of kc elements                                         */
+    void (*gemm_micro_kernel)(const size_t &kc,
+                              const double *Ap,
+                              const double *Bp,
+                              double       *acc);
+
+    // Softmax normalization of one vector
+    void (*softmax)(double *vec, const size_t &n);
+
+    /* Layer normalization of one vector, scaled and shifted; returns the
+     * inverse standard deviation of the vector                             */
+    double (*layer_norm)(double       *vec,
+                         const size_t &n,
+                         const double *scale,
+                         const double *shift);
+
+    // GELU approximation and its derivative, element-wise
+    void (*GELU_approx)(double *vec, double *vec_prime, const size_t &n);
+};
+
+
+/* -----------------------------------------------------------------------------
+ * Non-owning, two-dimensional view of (nrows, ncols) elements stored row by row,
+ * with consecutive rows 'row_stride' elements apart (row_stride==ncols means the
+ * view is contiguous). Vectors are (1, n)-shaped views. Element access is only
+ * bounds-checked in debug builds (i.e., when NDEBUG is not defined), so that
+ * loops over the elements compile to the same code as loops over raw pointers.
+ * ----------------------------------------------------------------------------- */
+template <typename T>
+class tensor_view_t {
+    private:
+        T      *ptr;
+        size_t  nrows, ncols, row_stride;
+
+    public:
+        tensor_view_t(T            *data,
+                      const size_t &nrows,
+                      const size_t &ncols,
+                      const size_t &row_stride)
+            : ptr(data), nrows(nrows), ncols(ncols), row_stride(row_stride) {}
+
+        tensor_view_t(T            *data,
+                      const size_t &nrows,
+                      const size_t &ncols)
+            : tensor_view_t(data, nrows, ncols, ncols) {}
+
+        // Read-only view of a read-write view
+        operator tensor_view_t<const T>() const {
+            return tensor_view_t<const T>(ptr, nrows, ncols, row_stride);
+        }
+
+        size_t rows()   const { return nrows; }
+        size_t cols()   const { return ncols; }
+        size_t size()   const { return nrows*ncols; }
+        size_t stride() const { return row_stride; }
+        T     *data()   const { return ptr; }
+
+        bool contiguous() const { return nrows <= 1 or row_stride == ncols; }
+
+        // Element (i, j), and element 'idx' of a contiguous view
+        T &operator()(const size_t &i, const size_t &j) const {
+            assert(i < nrows and j < ncols);
+            return ptr[i*row_stride + j];
+        }
+
+        T &operator[](const size_t &idx) const {
+            assert(contiguous() and idx < nrows*ncols);
+            return ptr[idx];
+        }
+
+        // Pointer to the first element of row 'i'
+        T *row(const size_t &i) const {
+            assert(i < nrows);
+            return ptr + i*row_stride;
+        }
+
+        // View of 'n' rows starting at row 'i', and of 'n' columns starting at column 'j'
+        tensor_view_t rows(const size_t &i, const size_t &n) const {
+            assert(i + n <= nrows);
+            return tensor_view_t(ptr + i*row_stride, n, ncols, row_stride);
+        }
+
+        tensor_view_t cols(const size_t &j, const size_t &n) const {
+            assert(j + n <= ncols);
+            return tensor_view_t(ptr + j, nrows, n, row_stride);
+        }
+};
+
+
+/* -----------------------------------------------------------------------------
+ * Two-dimensional tensor of (nrows, ncols) elements owning its contiguous,
+ * row-major storage. Element access is only bounds-checked in debug builds, as
+ * for tensor_view_t, into which a tensor converts implicitly.
+ * ----------------------------------------------------------------------------- */
+template <typename T>
+class tensor_t {
+    private:
+        std::vector<T> storage;
+        size_t         nrows, ncols;
+
+    public:
+        tensor_t(const size_t &nrows,
+                 const size_t &ncols,
+                 const T      &value = T())
+            : storage(nrows*ncols, value), nrows(nrows), ncols(ncols) {}
+
+        size_t   rows() const { return nrows; }
+        size_t   cols() const { return ncols; }
+        size_t   size() const { return storage.size(); }
+        T       *data()       { return storage.data(); }
+        const T *data() const { return storage.data(); }
+
+        auto begin()       { return storage.begin(); }
+        auto end()         { return storage.end(); }
+        auto begin() const { return storage.begin(); }
+        auto end()   const { return storage.end(); }
+
+        void fill(const T &value) { std::fill(storage.begin(), storage.end(), value); }
+
+        T &operator()(const size_t &i, const size_t &j) {
+            assert(i < nrows and j < ncols);
+            return storage[i*ncols + j];
+        }
+
+        const T &operator()(const size_t &i, const size_t &j) const {
+            assert(i < nrows and j < ncols);
+            return storage[i*ncols + j];
+        }
+
+        T &operator[](const size_t &idx) {
+            assert(idx < storage.size());
+            return storage[idx];
+        }
+
+        const T &operator[](const size_t &idx) const {
+            assert(idx < storage.size());
+            return storage[idx];
+        }
+
+        T *row(const size_t &i) {
+            assert(i < nrows);
+            return storage.data() + i*ncols;
+        }
+
+        const T *row(const size_t &i) const {
+            assert(i < nrows);
+            return storage.data() + i*ncols;
+        }
+
+        tensor_view_t<T>       view()       { return tensor_view_t<T>(storage.data(), nrows, ncols); }
+        tensor_view_t<const T> view() const { return tensor_view_t<const T>(storage.data(), nrows, ncols); }
+
+        operator tensor_view_t<T>()             { return view(); }
+        operator tensor_view_t<const T>() const { return view(); }
+};
+
+
+/* -----------------------------------------------------------------------------
+ * Arena holding all the trainable parameters of the model, their gradients, and
+ * (optionally) any per-parameter optimizer state (e.g., Adam's moments) in one
+ * aligned allocation. Each of these buffers has the same layout: the tensors
+ * registered with add() back to back, each starting on a cache-line boundary.
+ * Tensors are looked up by name once the arena is allocated, so that zeroing
+ * all the gradients or updating all the parameters are single sweeps over
+ * contiguous memory.
+ * ----------------------------------------------------------------------------- */
+class param_arena_t {
+    private:
+        struct entry_t {
+            std::string name;
+            size_t      nrows, ncols;
+            size_t      offset;      // In elements, from the start of each buffer
+            double      init_value;  // Initial value of the parameters
+        };
+
+        std::vector<entry_t> entries;
+        size_t               buffer_size;  // Elements per buffer, padding included
+        size_t               nstates;
+
+        std::unique_ptr<double, void(*)(void*)> storage;  // nstates+2 buffers
+
+        const entry_t &entry(const std::string &name) const;
+        tensor_view_t<double> view(const size_t &buffer, const std::string &name) const;
+
+    public:
+        // Alignment of the buffers and of each tensor in them, in bytes
+        static constexpr size_t alignment = 64;
+
+        param_arena_t();
+
+        param_arena_t(const param_arena_t&)            = delete;
+        param_arena_t &operator=(const param_arena_t&) = delete;
+
+        /* Register an (nrows, ncols)-shaped parameter tensor (throws if the
+         * name is taken or if the arena is already allocated)                  */
+        void add(const std::string &name,
+                 const size_t      &nrows,
+                 const size_t      &ncols,
+                 const double      &init_value = 0.);
+
+        /* Allocate the parameters (set to their initial values), the gradients
+         * (set to zero), and 'nstates' optimizer state buffers (set to zero)   */
+        void allocate(const size_t &nstates = 0);
+
+        bool   allocated() const { return static_cast<bool>(storage); }
+        size_t size()      const { return buffer_size; }
+
+        // Views of a parameter tensor, of its gradient, and of its k-th state
+        tensor_view_t<double> param(const std::string &name) const { return view(0, name); }
+        tensor_view_t<double> grad(const std::string &name)  const { return view(1, name); }
+        tensor_view_t<double> state(const size_t &k, const std::string &name) const;
+
+        // Whole buffers, size() elements each
+        double *params_data() const { return storage.get(); }
+        double *grads_data()  const { return storage.get() + buffer_size; }
 
-        // Encode (token-to-ID) method
-        std::vector<size_t> encode(const std::string &text);
+        // Zero all the gradients at once
+        void zero_grad();
 
-        // Decode (ID-to-token) method
-        std::string decode(const std::vector<size_t> &ids);
+        /* Stochastic gradient descent step on all the parameters at once,
+         * params -= learning_rate*grads, split across the threads of the pool */
+        void sgd_step(const double  &learning_rate,
+                      thread_pool_t &pool);
 };
 
 